@@ -117,4 +117,40 @@ def test_mp0_5():
         '11 directories, 0 files',
     )
 
+@test(10, "mp0 command with parallel workers")
+def test_mp0_6():
+    r.run_qemu(shell_script([
+        # 'testgen',
+        'mp0 os2023 o 3',
+    ]))
+    r.match(
+        'os2023 1',
+        'os2023/d1 1',
+        'os2023/d2 1',
+        'os2023/d2/a 1',
+        'os2023/d2/b 1',
+        'os2023/d2/c 1',
+        'os2023/d3 1',
+        'os2023/d3/a 1',
+        'os2023/d3/b 1',
+        '',
+        '6 directories, 2 files',
+    )
+
+
+@test(5, "file reaching into the double-indirect block")
+def test_bigfile():
+    r.run_qemu(shell_script([
+        'bigfile',
+    ]), timeout=60)
+    assert_lines_match(r.qemu.output, '^bigfile: ok$')
+
+
+@test(5, "many names in one directory")
+def test_dirnames():
+    r.run_qemu(shell_script([
+        'dirnames',
+    ]), timeout=60)
+    assert_lines_match(r.qemu.output, '^dirnames: ok$')
+
 run_tests()
@@ -101,6 +101,22 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Read directory entries from file f.
+// addr is a user virtual address, pointing to n bytes
+// to be filled with struct direntry records.
+int
+filereaddir(struct file *f, uint64 addr, int n)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  r = dirread(f->ip, addr, &f->off, n);
+  iunlock(f->ip);
+  return r;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -18,6 +18,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // icache hash chain
+  struct inode *prev; // icache free list, if ref is 0
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +29,11 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+  uint lastbn;        // last bmap() lookup: file block number
+  uint lastaddr;      //   and the disk block it mapped to (0 if none)
+  struct dirindex *dx; // T_DIR: hash index of entries, see dirlookup()
+  int dxbad;          // T_DIR: too large to index, always scan
 };
 
 // map major device number to device functions.
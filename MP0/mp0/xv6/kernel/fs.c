@@ -37,6 +37,40 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+// Free-space summary, built from the bitmap at mount time.
+// nfree[i] counts the free blocks described by bitmap block i,
+// so balloc() can skip full bitmap blocks without reading them,
+// and next is a next-fit cursor so that allocations without a
+// goal continue where the last one stopped instead of
+// rescanning the bitmap from block 0.
+#define NBMAP (FSSIZE/BPB + 1)
+
+struct {
+  struct spinlock lock;
+  uint nfree[NBMAP];
+  uint next;
+} bsum;
+
+static void
+bsuminit(int dev)
+{
+  int b, bi, i;
+  struct buf *bp;
+
+  initlock(&bsum.lock, "bsum");
+  if(sb.size > NBMAP*BPB)
+    panic("bsuminit: file system too large");
+  for(b = 0; b < sb.size; b += BPB){
+    i = b / BPB;
+    bp = bread(dev, BBLOCK(b, sb));
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[i]++;
+    brelse(bp);
+  }
+  bsum.next = 0;
+}
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,6 +78,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
 }
 
 // Zero a block.
@@ -60,27 +95,64 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Look for a free block in the bitmap block covering b,
+// starting at b and stopping at the end of that bitmap block.
+// Marks the block in use and returns it, or returns 0.
 static uint
-balloc(uint dev)
+bscan(uint dev, uint b)
 {
-  int b, bi, m;
+  int bi, m, end;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  bp = bread(dev, BBLOCK(b, sb));
+  end = min(BPB, sb.size - b / BPB * BPB);
+  for(bi = b % BPB; bi < end; bi++){
+    if(bi % 8 == 0 && bp->data[bi/8] == 0xff){
+      bi += 7;  // whole byte in use
+      continue;
     }
-    brelse(bp);
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0){  // Is block free?
+      bp->data[bi/8] |= m;  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      return b / BPB * BPB + bi;
+    }
+  }
+  brelse(bp);
+  return 0;
+}
+
+// Allocate a zeroed disk block, preferably at or after goal
+// so that consecutive blocks of a file end up adjacent on disk.
+// A goal of 0 means no preference.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b, r, n, i;
+
+  acquire(&bsum.lock);
+  if(goal == 0 || goal >= sb.size)
+    goal = bsum.next;
+  release(&bsum.lock);
+
+  // Visit each bitmap block once, starting with goal's and
+  // wrapping around, then goal's block again from its start
+  // in case the only free bits lie before goal.
+  b = goal;
+  for(n = 0; n <= (sb.size + BPB - 1) / BPB; n++){
+    i = b / BPB;
+    if(bsum.nfree[i] > 0 && (r = bscan(dev, b)) != 0){
+      acquire(&bsum.lock);
+      bsum.nfree[i]--;
+      bsum.next = r + 1 < sb.size ? r + 1 : 0;
+      release(&bsum.lock);
+      bzero(dev, r);
+      return r;
+    }
+    b = (i + 1) * BPB;
+    if(b >= sb.size)
+      b = 0;
   }
   panic("balloc: out of blocks");
 }
@@ -100,6 +172,10 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+
+  acquire(&bsum.lock);
+  bsum.nfree[b / BPB]++;
+  release(&bsum.lock);
 }
 
 // Inodes.
@@ -132,13 +208,15 @@ bfree(int dev, uint b)
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. A free entry keeps its contents and
+//   stays findable by iget() until it is recycled, least
+//   recently released first.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -165,26 +243,79 @@ bfree(int dev, uint b)
 // The icache.lock spin-lock protects the allocation of icache
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// holds, one must hold icache.lock while using any of those fields,
+// or the hash and free-list links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum and the links.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// The cache starts with NINODE entries and grows a page of
+// entries at a time whenever every entry is referenced.
+
+#define NIHASH 67
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
 
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+
+  // Hash chains of cached inodes by (dev, inum), through hnext.
+  struct inode *bucket[NIHASH];
+
+  // Linked list of free entries, through prev/next.
+  // Sorted by how recently the entry was released.
+  // free.next is most recent, free.prev is least.
+  struct inode free;
 } icache;
 
+static void dxdrop(struct inode*);
+static void dcinit(void);
+static void dcpurge(uint, uint);
+
+// Put ip on the free list: at the front if its contents are
+// worth keeping, at the back (recycled first) if not.
+static void
+ifree(struct inode *ip)
+{
+  struct inode *at;
+
+  at = ip->valid ? &icache.free : icache.free.prev;
+  ip->next = at->next;
+  ip->prev = at;
+  at->next->prev = ip;
+  at->next = ip;
+}
+
+// Add a page worth of entries to the inode cache.
+// Caller must hold icache.lock.
+static void
+igrow(void)
+{
+  struct inode *ip, *pg;
+
+  if((pg = (struct inode*)kalloc()) == 0)
+    panic("iget: no inodes");
+  memset(pg, 0, PGSIZE);
+  for(ip = pg; ip < pg + PGSIZE/sizeof(*ip); ip++){
+    initsleeplock(&ip->lock, "inode");
+    ifree(ip);
+  }
+}
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&icache.lock, "icache");
+  icache.free.prev = &icache.free;
+  icache.free.next = &icache.free;
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&icache.inode[i].lock, "inode");
+    ifree(&icache.inode[i]);
   }
+  dcinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -242,31 +373,43 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.bucket[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        ip->next->prev = ip->prev;
+        ip->prev->next = ip->next;
+      }
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Not cached.
+  // Recycle the least recently released entry.
+  if(icache.free.prev == &icache.free)
+    igrow();
+  ip = icache.free.prev;
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+
+  if(ip->inum){
+    for(pp = &icache.bucket[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
+  dxdrop(ip);
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = icache.bucket[IHASH(dev, inum)];
+  icache.bucket[IHASH(dev, inum)] = ip;
   release(&icache.lock);
 
   return ip;
@@ -306,6 +449,7 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->lastaddr = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -324,7 +468,7 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
-// be recycled.
+// be recycled, though iget() can still find it until then.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -343,6 +487,7 @@ iput(struct inode *ip)
 
     release(&icache.lock);
 
+    dcpurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -353,7 +498,8 @@ iput(struct inode *ip)
     acquire(&icache.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0)
+    ifree(ip);
   release(&icache.lock);
 }
 
@@ -370,38 +516,93 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The next NDINDIRECT
+// blocks are reached through the double-indirect block
+// ip->addrs[NDIRECT+1], each entry of which names another
+// indirect block.
+
+// Return entry idx of the indirect block at *slot,
+// allocating the indirect block and the entry if necessary.
+// New blocks are placed near goal.
+static uint
+bindirect(struct inode *ip, uint *slot, uint idx, uint goal)
+{
+  uint addr, *a;
+  struct buf *bp;
+
+  if((addr = *slot) == 0)
+    *slot = addr = balloc(ip->dev, goal);
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[idx]) == 0){
+    a[idx] = addr = balloc(ip->dev, goal);
+    log_write(bp);
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
+// The last mapping is remembered in the inode, so the many
+// small readi() calls made against one block (dirlookup, for
+// instance) do not re-read the indirect blocks each time.
+// It also supplies the allocation goal: when a file grows
+// sequentially, block bn is placed right after block bn-1.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, ind, goal;
+
+  if(ip->lastaddr && ip->lastbn == bn)
+    return ip->lastaddr;
+
+  goal = 0;
+  if(ip->lastaddr && ip->lastbn + 1 == bn)
+    goal = ip->lastaddr + 1;
+  else if(bn > 0 && bn <= NDIRECT && ip->addrs[bn-1])
+    goal = ip->addrs[bn-1] + 1;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
-  }
-  bn -= NDIRECT;
-
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+      ip->addrs[bn] = addr = balloc(ip->dev, goal);
+  } else if(bn - NDIRECT < NINDIRECT){
+    addr = bindirect(ip, &ip->addrs[NDIRECT], bn - NDIRECT, goal);
+  } else if(bn - NDIRECT - NINDIRECT < NDINDIRECT){
+    bn -= NDIRECT + NINDIRECT;
+    ind = bindirect(ip, &ip->addrs[NDIRECT+1], bn / NINDIRECT, goal);
+    addr = bindirect(ip, &ind, bn % NINDIRECT, goal);
+    bn += NDIRECT + NINDIRECT;
+  } else {
+    panic("bmap: out of range");
   }
 
-  panic("bmap: out of range");
+  ip->lastbn = bn;
+  ip->lastaddr = addr;
+  return addr;
+}
+
+// Free the indirect block addr and every block it lists.
+// If depth > 1, the listed blocks are themselves indirect.
+static void
+bfreeind(struct inode *ip, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      bfreeind(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -409,9 +610,7 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -421,17 +620,17 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfreeind(ip, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    bfreeind(ip, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
+  ip->lastaddr = 0;
+  dxdrop(ip);
   ip->size = 0;
   iupdate(ip);
 }
@@ -521,32 +720,294 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory index.
+//
+// Looking a name up in a large directory would mean reading
+// every dirent. Instead, the first dirlookup() on a directory
+// builds an in-memory hash table from name to dirent number,
+// held in one page hanging off the cached inode, and dirlink()
+// and dirunlink() keep it up to date. The index lives as long
+// as the inode stays in the cache. Directories with more
+// entries than the table can hold are marked dxbad and fall
+// back to a linear scan. Protected by the directory's ip->lock.
+
+#define DXSLOTS ((PGSIZE - 2*sizeof(uint)) / sizeof(ushort))
+#define DXMAX   (DXSLOTS / 4 * 3)  // max used slots, keeps probes short
+#define DXTOMB  0xffff             // slot of a removed entry
+
+struct dirindex {
+  uint nused;             // slots holding an entry or a tombstone
+  uint freeoff;           // no empty dirent below this offset
+  ushort slot[DXSLOTS];   // dirent number + 1, or 0, or DXTOMB
+};
+
+// FNV-1a hash of a path element.
+static uint
+namehash(char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+static uint
+dxhash(char *name)
+{
+  return namehash(name) % DXSLOTS;
+}
+
+// Discard ip's directory index, if any.
+static void
+dxdrop(struct inode *ip)
+{
+  if(ip->dx){
+    kfree((char*)ip->dx);
+    ip->dx = 0;
+  }
+  ip->dxbad = 0;
+}
+
+// Record that dirent number n holds name.
+// Returns -1 if the index is full.
+static int
+dxinsert(struct dirindex *dx, char *name, uint n)
+{
+  uint i;
+
+  if(dx->nused >= DXMAX || n + 1 >= DXTOMB)
+    return -1;
+  for(i = dxhash(name); dx->slot[i] != 0 && dx->slot[i] != DXTOMB; i = (i + 1) % DXSLOTS)
+    ;
+  if(dx->slot[i] == 0)
+    dx->nused++;
+  dx->slot[i] = n + 1;
+  return 0;
+}
+
+// Forget that dirent number n holds name.
+static void
+dxremove(struct dirindex *dx, char *name, uint n)
+{
+  uint i;
+
+  for(i = dxhash(name); dx->slot[i] != 0; i = (i + 1) % DXSLOTS){
+    if(dx->slot[i] == n + 1){
+      dx->slot[i] = DXTOMB;
+      return;
+    }
+  }
+}
+
+// (Re)build the index of directory dp from its entries.
+// Caller must hold dp->lock.
+static void
+dxbuild(struct inode *dp)
+{
+  uint off;
+  struct dirent de;
+  struct dirindex *dx;
+
+  dxdrop(dp);
+  if((dx = (struct dirindex*)kalloc()) == 0)
+    return;  // try again next time
+  memset(dx, 0, sizeof(*dx));
+  dx->freeoff = dp->size;
+  for(off = 0; off < dp->size; off += sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dxbuild read");
+    if(de.inum == 0){
+      if(off < dx->freeoff)
+        dx->freeoff = off;
+      continue;
+    }
+    if(dxinsert(dx, de.name, off / sizeof(de)) < 0){
+      kfree((char*)dx);
+      dp->dxbad = 1;
+      return;
+    }
+  }
+  dp->dx = dx;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, inum, i;
   struct dirent de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dp->dx == 0 && !dp->dxbad)
+    dxbuild(dp);
+
+  if(dp->dx){
+    for(i = dxhash(name); dp->dx->slot[i] != 0; i = (i + 1) % DXSLOTS){
+      if(dp->dx->slot[i] == DXTOMB)
+        continue;
+      off = (dp->dx->slot[i] - 1) * sizeof(de);
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlookup read");
+      if(de.inum != 0 && namecmp(name, de.name) == 0)
+        goto found;
+    }
+    return 0;
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
     if(de.inum == 0)
       continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+    if(namecmp(name, de.name) == 0)
+      goto found;
   }
 
   return 0;
+
+found:
+  // entry matches path element
+  if(poff)
+    *poff = off;
+  inum = de.inum;
+  return iget(dp->dev, inum);
+}
+
+// Name cache.
+//
+// namex() would otherwise lock every directory along a path
+// and call dirlookup() on it. The name cache remembers recent
+// lookups as (dev, directory inum, name) -> inum, where inum 0
+// records that the name does not exist. Only directories get
+// entries, so a hit also tells namex() that the parent is a
+// directory and it can skip ilock() altogether. dirlink() and
+// dirunlink() invalidate the affected name, and freeing an
+// inode purges every entry that mentions it.
+//
+// The cache is set-associative: a name hashes to one of
+// NDCSET sets and replaces the least recently used of its
+// NDCWAY entries.
+
+#define NDCSET 64
+#define NDCWAY 4
+
+struct dcent {
+  uint dev;
+  uint dir;         // directory inum, 0 if the entry is unused
+  uint inum;        // inum of name in dir, 0 if not present
+  uint used;        // dcache.clock at last use
+  char name[DIRSIZ];
+};
+
+struct {
+  struct spinlock lock;
+  uint clock;
+  struct dcent ent[NDCSET][NDCWAY];
+} dcache;
+
+static void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dcent*
+dcset(uint dev, uint dir, char *name)
+{
+  return dcache.ent[(namehash(name) ^ dir ^ dev) % NDCSET];
+}
+
+// Find the entry for name in directory dir.
+// Caller must hold dcache.lock.
+static struct dcent*
+dcfind(uint dev, uint dir, char *name)
+{
+  struct dcent *e, *set;
+
+  set = dcset(dev, dir, name);
+  for(e = set; e < set + NDCWAY; e++)
+    if(e->dir == dir && e->dev == dev && namecmp(e->name, name) == 0)
+      return e;
+  return 0;
+}
+
+// Look name up in the cache on behalf of namex().
+// On a hit, return 1 and set *ipp to the referenced inode,
+// or to 0 if the name is known not to exist. Return 0 on a miss.
+static int
+dclookup(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct dcent *e;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  e->used = ++dcache.clock;
+  // Take the reference before releasing the lock, so that
+  // an unlink cannot free the inode in between.
+  *ipp = e->inum ? iget(dp->dev, e->inum) : 0;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Remember that name in directory dir is inum (0: absent).
+// Caller must hold the directory's ip->lock.
+static void
+dcenter(uint dev, uint dir, char *name, uint inum)
+{
+  struct dcent *e, *f, *set;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dev, dir, name)) == 0){
+    set = dcset(dev, dir, name);
+    e = set;
+    for(f = set + 1; f < set + NDCWAY; f++)
+      if(f->used < e->used)
+        e = f;
+    e->dev = dev;
+    e->dir = dir;
+    strncpy(e->name, name, DIRSIZ);
+  }
+  e->inum = inum;
+  e->used = ++dcache.clock;
+  release(&dcache.lock);
+}
+
+// Forget name in directory dir.
+static void
+dcinval(uint dev, uint dir, char *name)
+{
+  struct dcent *e;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dev, dir, name)) != 0){
+    e->dir = 0;
+    e->used = 0;
+  }
+  release(&dcache.lock);
+}
+
+// Forget every entry naming inum or listing its contents.
+static void
+dcpurge(uint dev, uint inum)
+{
+  struct dcent *e;
+
+  acquire(&dcache.lock);
+  for(e = &dcache.ent[0][0]; e < &dcache.ent[NDCSET][0]; e++){
+    if(e->dev == dev && (e->dir == inum || e->inum == inum)){
+      e->dir = 0;
+      e->used = 0;
+    }
+  }
+  release(&dcache.lock);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -564,7 +1025,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   }
 
   // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  for(off = dp->dx ? dp->dx->freeoff : 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
     if(de.inum == 0)
@@ -575,10 +1036,83 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcinval(dp->dev, dp->inum, name);
+
+  if(dp->dx){
+    dp->dx->freeoff = off + sizeof(de);
+    if(dxinsert(dp->dx, name, off / sizeof(de)) < 0)
+      dxbuild(dp);  // clears tombstones, or gives up on indexing
+  }
 
   return 0;
 }
 
+// Remove the entry name, found at byte offset off by
+// dirlookup(), from the directory dp.
+// Caller must hold dp->lock.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink: writei");
+  dcinval(dp->dev, dp->inum, name);
+
+  if(dp->dx){
+    dxremove(dp->dx, name, off / sizeof(de));
+    if(off < dp->dx->freeoff)
+      dp->dx->freeoff = off;
+  }
+}
+
+// Return the type of inode inum as recorded on disk,
+// without locking the inode.
+static short
+itype(uint dev, uint inum)
+{
+  struct buf *bp;
+  short type;
+
+  bp = bread(dev, IBLOCK(inum, sb));
+  type = ((struct dinode*)bp->data + inum%IPB)->type;
+  brelse(bp);
+  return type;
+}
+
+// Copy the entries of directory dp, starting at byte offset
+// *poff, to user address dst as struct direntry records,
+// filling at most n bytes. Each record carries the type of
+// the inode it names, so callers need not stat every entry.
+// Advances *poff past the entries consumed.
+// Returns the number of bytes copied, or -1.
+// Caller must hold dp->lock.
+int
+dirread(struct inode *dp, uint64 dst, uint *poff, int n)
+{
+  int tot;
+  struct dirent de;
+  struct direntry e;
+
+  if(dp->type != T_DIR || n < 0)
+    return -1;
+
+  for(tot = 0; tot + sizeof(e) <= n && *poff < dp->size; *poff += sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, *poff, sizeof(de)) != sizeof(de))
+      panic("dirread read");
+    if(de.inum == 0)
+      continue;
+    e.inum = de.inum;
+    e.type = itype(dp->dev, de.inum);
+    memmove(e.name, de.name, DIRSIZ);
+    if(either_copyout(1, dst + tot, &e, sizeof(e)) == -1)
+      return -1;
+    tot += sizeof(e);
+  }
+  return tot;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -633,6 +1167,13 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    if(!(nameiparent && *path == '\0') && dclookup(ip, name, &next)){
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -643,7 +1184,9 @@ namex(char *path, int nameiparent, char *name)
       iunlock(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
+    next = dirlookup(ip, name, 0);
+    dcenter(ip->dev, ip->inum, name, next ? next->inum : 0);
+    if(next == 0){
       iunlockput(ip);
       return 0;
     }
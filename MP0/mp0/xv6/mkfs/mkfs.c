@@ -40,6 +40,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+uint indirect(uint *slot, uint idx);
 
 // convert to intel byte order
 ushort
@@ -260,6 +261,26 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry idx of the indirect block at *slot,
+// allocating the indirect block and the entry if necessary.
+uint
+indirect(uint *slot, uint idx)
+{
+  uint a[NINDIRECT];
+
+  if(xint(*slot) == 0){
+    *slot = xint(freeblock++);
+    bzero(a, sizeof(a));
+  } else {
+    rsect(xint(*slot), (char*)a);
+  }
+  if(a[idx] == 0){
+    a[idx] = xint(freeblock++);
+    wsect(xint(*slot), (char*)a);
+  }
+  return xint(a[idx]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -267,8 +288,7 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
+  uint x, ind;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -281,16 +301,13 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
+    } else if(fbn < NDIRECT + NINDIRECT){
+      x = indirect(&din.addrs[NDIRECT], fbn - NDIRECT);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
+      fbn -= NDIRECT + NINDIRECT;
+      ind = xint(indirect(&din.addrs[NDIRECT+1], fbn / NINDIRECT));
+      x = indirect(&ind, fbn % NINDIRECT);
+      fbn += NDIRECT + NINDIRECT;
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -0,0 +1,84 @@
+// Write a file that needs the double-indirect block, read it
+// back, then remove it and do it all again.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define FILE "bigfile.dat"
+#define NBLOCKS (NDIRECT + NINDIRECT + 40)
+
+char buf[BSIZE];
+
+void
+err(char *why)
+{
+  printf("bigfile: %s failed\n", why);
+  unlink(FILE);
+  exit(1);
+}
+
+// Block b of the file starts with b and is filled with b's low byte.
+void
+fill(int b)
+{
+  memset(buf, b, sizeof(buf));
+  *(int*)buf = b;
+}
+
+void
+writefile(void)
+{
+  int fd, b;
+
+  if((fd = open(FILE, O_CREATE | O_WRONLY)) < 0)
+    err("create");
+  for(b = 0; b < NBLOCKS; b++){
+    fill(b);
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+      err("write");
+  }
+  close(fd);
+}
+
+void
+readfile(void)
+{
+  int fd, b, i;
+  struct stat st;
+
+  if((fd = open(FILE, O_RDONLY)) < 0)
+    err("open");
+  if(fstat(fd, &st) < 0 || st.size != NBLOCKS * BSIZE)
+    err("size");
+  for(b = 0; b < NBLOCKS; b++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf))
+      err("read");
+    if(*(int*)buf != b)
+      err("content");
+    for(i = sizeof(int); i < sizeof(buf); i++)
+      if(buf[i] != (char)b)
+        err("content");
+  }
+  if(read(fd, buf, 1) != 0)
+    err("eof");
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  writefile();
+  readfile();
+  // Again, once itrunc() has freed the whole block tree.
+  if(unlink(FILE) < 0)
+    err("unlink");
+  writefile();
+  readfile();
+  if(unlink(FILE) < 0)
+    err("unlink");
+  printf("bigfile: ok\n");
+  exit(0);
+}
@@ -0,0 +1,112 @@
+// Fill one directory with names, look them up, remove and
+// re-create some of them, and check that every lookup sees the
+// current entry rather than a stale one.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define DIR "dirnames.d"
+#define NNAMES 400
+
+char path[32];
+
+void
+err(char *why)
+{
+  printf("dirnames: %s failed\n", why);
+  exit(1);
+}
+
+char*
+name(int i)
+{
+  char *p;
+
+  strcpy(path, DIR "/n");
+  p = path + strlen(path);
+  p[0] = '0' + i / 100;
+  p[1] = '0' + i / 10 % 10;
+  p[2] = '0' + i % 10;
+  p[3] = 0;
+  return path;
+}
+
+// Inode number of path, or 0 if it does not exist.
+uint
+ino(char *p)
+{
+  struct stat st;
+
+  if(stat(p, &st) < 0)
+    return 0;
+  return st.ino;
+}
+
+// A new empty file; returns its inode number.
+uint
+create(char *p)
+{
+  int fd;
+  uint n;
+
+  if((fd = open(p, O_CREATE | O_RDWR)) < 0)
+    err("create");
+  close(fd);
+  if((n = ino(p)) == 0)
+    err("stat");
+  return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint x, y;
+  int i;
+
+  if(mkdir(DIR) < 0)
+    err("mkdir");
+  x = create(DIR "/x");
+  y = create(DIR "/y");
+
+  // Many links to x, so names do not run out of inodes.
+  for(i = 0; i < NNAMES; i++)
+    if(link(DIR "/x", name(i)) < 0)
+      err("link");
+  for(i = 0; i < NNAMES; i++)
+    if(ino(name(i)) != x)
+      err("lookup");
+  if(ino(DIR "/nope") != 0)
+    err("missing lookup");
+
+  // Remove every third name; only those must be gone.
+  for(i = 0; i < NNAMES; i += 3)
+    if(unlink(name(i)) < 0)
+      err("unlink");
+  for(i = 0; i < NNAMES; i++)
+    if((ino(name(i)) == 0) != (i % 3 == 0))
+      err("lookup after unlink");
+
+  // Bring them back as links to y, then a few as new files.
+  for(i = 0; i < NNAMES; i += 3)
+    if(link(DIR "/y", name(i)) < 0)
+      err("relink");
+  for(i = 0; i < NNAMES; i++)
+    if(ino(name(i)) != (i % 3 == 0 ? y : x))
+      err("lookup after relink");
+  for(i = 0; i < 30; i += 3){
+    if(unlink(name(i)) < 0)
+      err("unlink");
+    if(create(name(i)) == y || ino(name(i)) == y)
+      err("lookup after re-create");
+  }
+
+  for(i = 0; i < NNAMES; i++)
+    if(unlink(name(i)) < 0)
+      err("cleanup");
+  if(unlink(DIR "/x") < 0 || unlink(DIR "/y") < 0 || unlink(DIR) < 0)
+    err("cleanup");
+  printf("dirnames: ok\n");
+  exit(0);
+}
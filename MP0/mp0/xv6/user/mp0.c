@@ -5,6 +5,21 @@
 #include "user/user.h"
 
 #define MAX_DEPTH 20
+#define MAX_WORKERS 4 // each worker costs the coordinator two of its NOFILE fds
+
+// Parallel mode: workers stream what they find to the coordinator
+// as a rec header followed by len bytes of path (no NUL).
+struct rec {
+    short type;   // T_DIR, T_FILE, or one of the REC_ values below
+    ushort count; // occurrences of the key in the path
+    ushort len;   // length of the path that follows
+};
+
+#define REC_END     0  // end of the subtree the worker was handed
+#define REC_OPENERR -1 // path could not be opened
+#define REC_TOOLONG -2 // path too long to descend into
+
+int outfd = -1; // in a worker: where records go instead of stdout
 
 int occurrence(char *str, char key){ //count the occurrence of the key 
     int count = 0;
@@ -17,7 +32,37 @@ int occurrence(char *str, char key){ //count the occurrence of the key
     }
     return count;
 }
-void print(char *path, char *basename, int level, int is_last[], char key) { 
+// Show one line of output for path.
+void show(char *path, int type, int count) {
+    if (type == REC_OPENERR) {
+        printf("%s [error opening dir]\n", path);
+    } else if (type == REC_TOOLONG) {
+        printf("tree: path too long\n");
+    } else {
+        printf("%s %d\n", path, count);
+    }
+}
+
+// Show path, or in a worker, send it to the coordinator.
+void report(char *path, int type, int count) {
+    char buf[sizeof(struct rec) + 512];
+    struct rec *r = (struct rec *)buf;
+
+    if (outfd < 0) {
+        show(path, type, count);
+        return;
+    }
+    r->type = type;
+    r->count = count;
+    r->len = path ? strlen(path) : 0;
+    if (r->len > sizeof(buf) - sizeof(*r)) {
+        r->len = sizeof(buf) - sizeof(*r);
+    }
+    memmove(buf + sizeof(*r), path, r->len);
+    write(outfd, buf, sizeof(*r) + r->len);
+}
+
+void print(char *path, char *basename, int type, int level, int is_last[], char key) { 
     /*
     if (level > 0) {
         for (int i = 0; i < level - 1; i++) {
@@ -34,49 +79,66 @@ void print(char *path, char *basename, int level, int is_last[], char key) {
         printf("+-- %s", basename);
     }
     */
-    printf("%s", path);
-    int count = occurrence(path, key);
-    printf(" %d\n", count);
+    report(path, type, occurrence(path, key));
 }
+#define NDENT 64 // entries fetched per getdents call: one directory block
+
+void traverse(char *path, char *basename, int level, int is_last[], int *file_num,
+              int *dir_num, int key);
+
+// Print and count the directory entry e found under buf, whose
+// name goes at p, recursing if it is a directory.
+void visit(char *buf, char *p, struct direntry *e, int level, int last, int is_last[],
+           int *file_num, int *dir_num, int key) {
+    memmove(p, e->name, DIRSIZ);
+    p[DIRSIZ] = 0;
+    if (last) {
+        is_last[level] = 1;
+    }
+    if (e->type == T_FILE) {
+        (*file_num)++;
+        print(buf, p, e->type, level + 1, is_last, key);
+    } else if (e->type == T_DIR) {
+        (*dir_num)++;
+        print(buf, p, e->type, level + 1, is_last, key);
+        traverse(buf, p, level + 1, is_last, file_num, dir_num, key);
+    }
+    is_last[level] = 0;
+}
+
 void traverse(char *path, char *basename, int level, int is_last[], int *file_num,
               int *dir_num, int key) {
     char buf[512], *p;
-    int fd;
-    struct dirent de;
+    int fd, n, i, pending = 0;
+    struct direntry *ents, prev;
     struct stat st;
 
     if ((fd = open(path, 0)) < 0) {
-        printf("%s [error opening dir]\n", path);
+        report(path, REC_OPENERR, 0);
         return;
     }
 
-    if (fstat(fd, &st) < 0) {
-        fprintf(2, "tree: cannot stat (new recursion) %s\n", path);
-        return;
-    } else {
-        close(fd);
-    }
-
-    if (st.type == T_FILE) { //it is a file 
-        if (level == 0) {
-            printf("%s [error opening dir]\n", path);
+    // Below the top level the caller already knows path is a
+    // directory from getdents, so only the root needs a stat.
+    if (level == 0) {
+        if (fstat(fd, &st) < 0) {
+            fprintf(2, "tree: cannot stat (new recursion) %s\n", path);
+            close(fd);
             return;
         }
-        (*file_num)++;
-        print(path, basename, level, is_last, key);
-        return;
-    } else if (st.type == T_DIR) { //it is a directory (leaf)
-        if (level > 0) {
-            (*dir_num)++;
+        if (st.type == T_FILE) {
+            report(path, REC_OPENERR, 0);
+            close(fd);
+            return;
+        } else if (st.type != T_DIR) {
+            close(fd);
+            return;
         }
-        print(path, basename, level, is_last, key);
-    } else {
-        // printf("tree: path %s is a device\n", path);
-        return;
+        print(path, basename, T_DIR, level, is_last, key);
     }
 
     if (strlen(path) + 1 + DIRSIZ + 1 > sizeof buf) {
-        printf("tree: path too long\n");
+        report(path, REC_TOOLONG, 0);
         close(fd);
         return;
     }
@@ -84,45 +146,213 @@ void traverse(char *path, char *basename, int level, int is_last[], int *file_nu
     p = buf + strlen(buf);
     *p++ = '/';
 
-    int count = 0;
-    if ((fd = open(path, 0)) < 0) {
-        printf("%s [error opening dir]\n", path);
+    if ((ents = malloc(NDENT * sizeof(*ents))) == 0) {
+        fprintf(2, "tree: out of memory\n");
+        close(fd);
         return;
     }
-    while (read(fd, &de, sizeof(de)) == sizeof(de)) {
-        if (de.inum == 0)
-            continue;
-        memmove(p, de.name, DIRSIZ);
-        p[DIRSIZ] = 0;
-        if (strcmp(de.name, ".") && strcmp(de.name, "..")) {
-            count++;
+    // Each entry is visited only once the next one has been read,
+    // so that the last entry of the directory can be marked.
+    while ((n = getdents(fd, ents, NDENT * sizeof(*ents))) > 0) {
+        for (i = 0; i < n / sizeof(*ents); i++) {
+            if (!strcmp(ents[i].name, ".") || !strcmp(ents[i].name, "..")) {
+                continue;
+            }
+            if (pending) {
+                visit(buf, p, &prev, level, 0, is_last, file_num, dir_num, key);
+            }
+            prev = ents[i];
+            pending = 1;
         }
     }
+    if (pending) {
+        visit(buf, p, &prev, level, 1, is_last, file_num, dir_num, key);
+    }
+
+    free(ents);
     close(fd);
-    if ((fd = open(path, 0)) < 0) {
-        fprintf(2, "tree: cannot open %s after counting files\n", path);
+    return;
+}
+
+// Read exactly n bytes from fd, unless it reaches end of file.
+int readn(int fd, void *buf, int n) {
+    int r, tot = 0;
+
+    while (tot < n && (r = read(fd, (char *)buf + tot, n - tot)) > 0) {
+        tot += r;
+    }
+    return tot;
+}
+
+// Hand the subtree path to a worker over its task pipe.
+void sendtask(int fd, char *path) {
+    char buf[sizeof(ushort) + 512];
+    ushort len = strlen(path);
+
+    memmove(buf, &len, sizeof(len));
+    memmove(buf + sizeof(len), path, len);
+    write(fd, buf, sizeof(len) + len);
+}
+
+// Worker: walk each subtree named on taskfd, streaming records
+// to outfd, until the coordinator closes taskfd.
+void worker(int taskfd, int key) {
+    char path[512];
+    ushort len;
+    int file_num = 0, dir_num = 0;
+    int is_last[MAX_DEPTH] = {};
+
+    while (readn(taskfd, &len, sizeof(len)) == sizeof(len)) {
+        if (len >= sizeof(path) || readn(taskfd, path, len) != len) {
+            break;
+        }
+        path[len] = 0;
+        print(path, path, T_DIR, 1, is_last, key);
+        traverse(path, path, 1, is_last, &file_num, &dir_num, key);
+        report(0, REC_END, 0);
+    }
+    exit(0);
+}
+
+// Copy the records of one subtree from a worker to stdout.
+void drain(int fd, int *file_num, int *dir_num) {
+    char path[513];
+    struct rec r;
+
+    while (readn(fd, &r, sizeof(r)) == sizeof(r) && r.type != REC_END) {
+        if (r.len >= sizeof(path) || readn(fd, path, r.len) != r.len) {
+            break;
+        }
+        path[r.len] = 0;
+        if (r.type == T_FILE) {
+            (*file_num)++;
+        } else if (r.type == T_DIR) {
+            (*dir_num)++;
+        }
+        show(path, r.type, r.count);
+    }
+}
+
+// Nonzero if e is a subdirectory other than . and ..
+int issubdir(struct direntry *e) {
+    return e->type == T_DIR && strcmp(e->name, ".") && strcmp(e->name, "..");
+}
+
+// Like traverse(path, ...) at the top level, but each subdirectory
+// of path is walked by one of nworkers worker processes. Subdirectory
+// j goes to worker j % nworkers, and the coordinator copies their
+// output in directory order, so the result is the same as traverse's.
+void traverse_parallel(char *path, int nworkers, int *file_num, int *dir_num, int key) {
+    char buf[512], *p;
+    int fd, n, i, j, ndir, nent, cap;
+    int taskfd[MAX_WORKERS], resfd[MAX_WORKERS], tfds[2], rfds[2];
+    struct direntry *ents, *grown;
+    struct stat st;
+    int is_last[MAX_DEPTH] = {};
+
+    if ((fd = open(path, 0)) < 0 || fstat(fd, &st) < 0 || st.type != T_DIR ||
+        strlen(path) + 1 + DIRSIZ + 1 > sizeof buf) {
+        // Nothing to parallelize; let traverse report the problem.
+        if (fd >= 0) {
+            close(fd);
+        }
+        traverse(path, path, 0, is_last, file_num, dir_num, key);
         return;
     }
-    // read files under current path
-    int cnt = 0;
-    while (read(fd, &de, sizeof(de)) == sizeof(de)) {
-        if (de.inum == 0)
-            continue;
+    print(path, path, T_DIR, 0, is_last, key);
 
-        memmove(p, de.name, DIRSIZ);
+    // Read the whole top-level directory first.
+    cap = NDENT;
+    nent = 0;
+    ents = malloc(cap * sizeof(*ents));
+    while (ents && (n = getdents(fd, ents + nent, (cap - nent) * sizeof(*ents))) > 0) {
+        nent += n / sizeof(*ents);
+        if (nent == cap) {
+            grown = malloc(2 * cap * sizeof(*ents));
+            if (grown) {
+                memmove(grown, ents, cap * sizeof(*ents));
+            }
+            free(ents);
+            ents = grown;
+            cap *= 2;
+        }
+    }
+    close(fd);
+    if (ents == 0) {
+        fprintf(2, "tree: out of memory\n");
+        return;
+    }
+
+    // Start the workers.
+    for (i = 0; i < nworkers; i++) {
+        if (pipe(tfds) < 0 || pipe(rfds) < 0) {
+            fprintf(2, "tree: pipe failed\n");
+            exit(-1);
+        }
+        if (fork() == 0) {
+            for (j = 0; j < i; j++) {
+                close(taskfd[j]);
+                close(resfd[j]);
+            }
+            close(tfds[1]);
+            close(rfds[0]);
+            outfd = rfds[1];
+            worker(tfds[0], key);
+        }
+        close(tfds[0]);
+        close(rfds[1]);
+        taskfd[i] = tfds[1];
+        resfd[i] = rfds[0];
+    }
+
+    strcpy(buf, path);
+    p = buf + strlen(buf);
+    *p++ = '/';
+
+    // Hand out the first subdirectory to each worker. After that, a
+    // worker gets its next one only once its current one is drained,
+    // so we never block writing to a worker that is itself blocked
+    // on a full result pipe.
+    for (i = 0, ndir = 0; i < nent && ndir < nworkers; i++) {
+        if (issubdir(&ents[i])) {
+            memmove(p, ents[i].name, DIRSIZ);
+            p[DIRSIZ] = 0;
+            sendtask(taskfd[ndir++], buf);
+        }
+    }
+
+    for (i = 0, ndir = 0; i < nent; i++) {
+        if (!strcmp(ents[i].name, ".") || !strcmp(ents[i].name, "..")) {
+            continue;
+        }
+        memmove(p, ents[i].name, DIRSIZ);
         p[DIRSIZ] = 0;
-        if (strcmp(de.name, ".") && strcmp(de.name, "..")) {
-            if (cnt == count - 1) {
-                is_last[level] = 1;
+        if (ents[i].type == T_FILE) {
+            (*file_num)++;
+            print(buf, p, T_FILE, 1, is_last, key);
+        } else if (ents[i].type == T_DIR) {
+            drain(resfd[ndir % nworkers], file_num, dir_num);
+            // This worker's next subdirectory is nworkers further on.
+            for (j = i + 1, n = 0; j < nent; j++) {
+                if (issubdir(&ents[j]) && ++n == nworkers) {
+                    memmove(p, ents[j].name, DIRSIZ);
+                    p[DIRSIZ] = 0;
+                    sendtask(taskfd[ndir % nworkers], buf);
+                    break;
+                }
             }
-            cnt++;
-            traverse(buf, de.name, level + 1, is_last, file_num, dir_num, key);
-            is_last[level] = 0;
+            ndir++;
         }
     }
 
-    close(fd);
-    return;
+    for (i = 0; i < nworkers; i++) {
+        close(taskfd[i]);
+        close(resfd[i]);
+    }
+    for (i = 0; i < nworkers; i++) {
+        wait(0);
+    }
+    free(ents);
 }
 
 int main(int argc, char *argv[]) {
@@ -132,6 +362,11 @@ int main(int argc, char *argv[]) {
     int pid, ret = 0;
     int fds[2];
     char key = argv[2][0];
+    int nworkers = argc > 3 ? atoi(argv[3]) : 1;
+
+    if (nworkers > MAX_WORKERS) {
+        nworkers = MAX_WORKERS;
+    }
 
     if (argc < 2) {
         printf("tree: missing argv[1]\n");
@@ -149,7 +384,11 @@ int main(int argc, char *argv[]) {
     if (pid == 0) { // Child
         int file_num = 0, dir_num = 0;
         int is_last[MAX_DEPTH] = {};
-        traverse(argv[1], argv[1], 0, is_last, &file_num, &dir_num, key); //passing the key
+        if (nworkers > 1) {
+            traverse_parallel(argv[1], nworkers, &file_num, &dir_num, key);
+        } else {
+            traverse(argv[1], argv[1], 0, is_last, &file_num, &dir_num, key); //passing the key
+        }
 
         write(fds[1], &file_num, sizeof(int));
         write(fds[1], &dir_num, sizeof(int));
@@ -17,6 +17,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "poll.h"
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
@@ -77,9 +78,11 @@ consolewrite(int user_src, uint64 src, int n)
 // copy (up to) a whole input line to dst.
 // user_dist indicates whether dst is a user
 // or kernel address.
+// if nonblock, return what has arrived, or -1
+// if nothing has, instead of waiting.
 //
 int
-consoleread(int user_dst, uint64 dst, int n)
+consoleread(int user_dst, uint64 dst, int n, int nonblock)
 {
   uint target;
   int c;
@@ -91,10 +94,12 @@ consoleread(int user_dst, uint64 dst, int n)
     // wait until interrupt handler has put some
     // input into cons.buffer.
     while(cons.r == cons.w){
-      if(myproc()->killed){
+      if(myproc()->killed || (nonblock && n == target)){
         release(&cons.lock);
         return -1;
       }
+      if(nonblock)
+        goto out;
       sleep(&cons.r, &cons.lock);
     }
 
@@ -123,6 +128,7 @@ consoleread(int user_dst, uint64 dst, int n)
       break;
     }
   }
+ out:
   release(&cons.lock);
 
   return target - n;
@@ -172,6 +178,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwakeup();
       }
     }
     break;
@@ -180,6 +187,20 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+// a whole line, or end-of-file, can be read
+// without waiting; writes never wait for long.
+int
+consolepoll(void)
+{
+  int r = POLLOUT;
+
+  acquire(&cons.lock);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -191,4 +212,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
@@ -6,7 +6,9 @@ struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct rwlock;
 struct stat;
+struct lockstat;
 struct superblock;
 
 // bio.c
@@ -33,6 +35,13 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             fileready(struct file*, int);
+void            pollenter(int);
+void            pollexit(int);
+int             pollseq(void);
+void            pollsleep(int);
+void            pollwakeup(void);
+void            polltick(void);
 
 // fs.c
 void            fsinit(int);
@@ -73,8 +82,9 @@ void            end_op(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, uint64, int, int);
+int             pipewrite(struct pipe*, uint64, int, int);
+int             pipepoll(struct pipe*, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -85,11 +95,17 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             growproc(int, uint64*);
+int             clone(uint64, uint64, uint64);
+void            mmput(struct proc*, pagetable_t);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+int             setpriority(int, int);
+int             cputime(int);
+int             proctick(void);
+void            boost(void);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -101,6 +117,10 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeup_one(void*);
+int             wakeup_n(void*, int);
+int             futex_wait(uint64, int);
+int             futex_wake(uint64, int);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -110,9 +130,13 @@ void            procdump(void);
 void            swtch(struct context*, struct context*);
 
 // spinlock.c
+struct lockstat* lockclass(char*, int);
+void            lockstat_hold(struct lockstat*, uint64);
+int             lockstat_copyout(uint64, int);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initticketlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
@@ -123,6 +147,13 @@ void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// rwlock.c
+void            initrwlock(struct rwlock*, char*);
+void            acquireread(struct rwlock*);
+void            releaseread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+void            releasewrite(struct rwlock*);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -146,6 +177,7 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+uint64          sigreturn(uint64);
 
 // uart.c
 void            uartinit(void);
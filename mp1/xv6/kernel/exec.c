@@ -21,6 +21,11 @@ exec(char *path, char **argv)
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
+  // Other threads would be left running in the old image.
+  // (ref only grows by clone() from a thread in this mm.)
+  if(p->mm && p->mm->ref > 1)
+    return -1;
+
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -114,7 +119,12 @@ exec(char *path, char **argv)
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  p->alarmticks = 0;  // the handler is gone with the old image
+  p->alarmmasked = 0;
+  if(p->mm)
+    mmput(p, oldpagetable);
+  else
+    proc_freepagetable(oldpagetable, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -3,3 +3,8 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+#define O_NONBLOCK 0x800
+
+// fcntl() commands.
+#define F_GETFL   1  // return the open mode and O_NONBLOCK
+#define F_SETFL   2  // set O_NONBLOCK from the argument
@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -19,10 +20,21 @@ struct {
   struct file file[NFILE];
 } ftable;
 
+// poll() sleeps here until some file may have become ready.
+// Pipes and the console call pollwakeup() when they change,
+// and the clock does each tick while a poll() has a timeout.
+struct {
+  struct spinlock lock;
+  int seq;     // bumped by each wakeup
+  int npoll;   // processes in poll()
+  int ntimed;  // ... of which with a timeout
+} pollwait;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  initlock(&pollwait.lock, "pollwait");
 }
 
 // Allocate a file structure.
@@ -112,11 +124,11 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, addr, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(1, addr, n, f->nonblock);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
@@ -140,7 +152,7 @@ filewrite(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, addr, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
@@ -180,3 +192,87 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+
+// Return which of events, and of POLLHUP, hold for f.
+// Files and devices without a poll hook are always ready.
+int
+fileready(struct file *f, int events)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    r = pipepoll(f->pipe, f->writable);
+  else if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV && devsw[f->major].poll)
+    r = devsw[f->major].poll();
+  else
+    r = POLLIN | POLLOUT;
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r & (events | POLLHUP);
+}
+
+// Start or end a poll(), with a timeout or not.
+void
+pollenter(int timed)
+{
+  acquire(&pollwait.lock);
+  pollwait.npoll++;
+  pollwait.ntimed += timed;
+  release(&pollwait.lock);
+}
+
+void
+pollexit(int timed)
+{
+  acquire(&pollwait.lock);
+  pollwait.npoll--;
+  pollwait.ntimed -= timed;
+  release(&pollwait.lock);
+}
+
+// Return the wakeup count, for pollsleep().
+int
+pollseq(void)
+{
+  int seq;
+
+  acquire(&pollwait.lock);
+  seq = pollwait.seq;
+  release(&pollwait.lock);
+  return seq;
+}
+
+// Sleep unless there has been a wakeup since pollseq()
+// returned seq.
+void
+pollsleep(int seq)
+{
+  acquire(&pollwait.lock);
+  if(pollwait.seq == seq)
+    sleep(&pollwait.seq, &pollwait.lock);
+  release(&pollwait.lock);
+}
+
+// Wake up every poll(), if there is one.  The caller has just
+// made a change under the lock that fileready() takes to see it,
+// so a poll() that checked before the change is already counted.
+void
+pollwakeup(void)
+{
+  if(pollwait.npoll == 0)
+    return;
+  acquire(&pollwait.lock);
+  pollwait.seq++;
+  wakeup(&pollwait.seq);
+  release(&pollwait.lock);
+}
+
+// Called by the clock each tick.
+void
+polltick(void)
+{
+  if(pollwait.ntimed > 0)
+    pollwakeup();
+}
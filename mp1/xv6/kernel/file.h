@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK: fail reads and writes that would wait
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
@@ -31,8 +32,9 @@ struct inode {
 
 // map major device number to device functions.
 struct devsw {
-  int (*read)(int, uint64, int);
+  int (*read)(int, uint64, int, int);
   int (*write)(int, uint64, int);
+  int (*poll)(void);  // POLLIN and POLLOUT if ready, or 0 to always be
 };
 
 extern struct devsw devsw[];
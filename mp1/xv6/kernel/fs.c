@@ -17,6 +17,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "sleeplock.h"
+#include "rwlock.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
@@ -162,17 +163,20 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
+// The icache.lock reader-writer lock protects the allocation of
+// icache entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
+// Finding a cached inode and taking another reference to it only
+// needs the read lock, with ip->ref bumped atomically; anything
+// else that changes those fields needs the write lock.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
 struct {
-  struct spinlock lock;
+  struct rwlock lock;
   struct inode inode[NINODE];
 } icache;
 
@@ -181,7 +185,7 @@ iinit()
 {
   int i = 0;
   
-  initlock(&icache.lock, "icache");
+  initrwlock(&icache.lock, "icache");
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&icache.inode[i].lock, "inode");
   }
@@ -244,14 +248,26 @@ iget(uint dev, uint inum)
 {
   struct inode *ip, *empty;
 
-  acquire(&icache.lock);
+  // Is the inode already cached?  Usually it is, and then
+  // the read lock is enough.
+  acquireread(&icache.lock);
+  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
+    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+      __sync_fetch_and_add(&ip->ref, 1);
+      releaseread(&icache.lock);
+      return ip;
+    }
+  }
+  releaseread(&icache.lock);
 
-  // Is the inode already cached?
+  // Look again with the write lock, since it may have been
+  // cached in between.
+  acquirewrite(&icache.lock);
   empty = 0;
   for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
     if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
       ip->ref++;
-      release(&icache.lock);
+      releasewrite(&icache.lock);
       return ip;
     }
     if(empty == 0 && ip->ref == 0)    // Remember empty slot.
@@ -267,7 +283,7 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&icache.lock);
+  releasewrite(&icache.lock);
 
   return ip;
 }
@@ -277,9 +293,9 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
-  ip->ref++;
-  release(&icache.lock);
+  acquireread(&icache.lock);
+  __sync_fetch_and_add(&ip->ref, 1);
+  releaseread(&icache.lock);
   return ip;
 }
 
@@ -332,7 +348,7 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&icache.lock);
+  acquirewrite(&icache.lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -341,7 +357,7 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&icache.lock);
+    releasewrite(&icache.lock);
 
     itrunc(ip);
     ip->type = 0;
@@ -350,11 +366,11 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
-    acquire(&icache.lock);
+    acquirewrite(&icache.lock);
   }
 
   ip->ref--;
-  release(&icache.lock);
+  releasewrite(&icache.lock);
 }
 
 // Common idiom: unlock, then put.
@@ -26,7 +26,7 @@ struct {
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  initticketlock(&kmem.lock, "kmem");
   freerange(end, (void*)PHYSTOP);
 }
 
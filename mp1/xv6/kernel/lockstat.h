@@ -0,0 +1,11 @@
+// Lock contention statistics, kept per lock name when the
+// kernel is built with LOCKSTAT (make LOCKSTAT=1).
+// Times are in r_time() units.
+struct lockstat {
+  char name[16];     // Name given to initlock()/initsleeplock()
+  int sleep;         // Sleep lock, not spinlock
+  uint64 nacquire;   // Acquisitions
+  uint64 ncontend;   // Acquisitions that had to wait
+  uint64 wait;       // Total time spent waiting
+  uint64 maxhold;    // Longest time held (approximate)
+};
@@ -158,8 +158,8 @@ end_op(void)
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+    // the amount of reserved space, enough for one.
+    wakeup_one(&log);
   }
   release(&log.lock);
 
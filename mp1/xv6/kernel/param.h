@@ -11,3 +11,6 @@
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1200  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define NQUEUE       3     // scheduler priority levels
+#define BOOSTTICKS   50    // ticks between scheduler priority boosts
+#define NTHREAD      16    // clone()d threads per address space
@@ -7,6 +7,7 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
 #define PIPESIZE 512
 
@@ -38,10 +39,12 @@ pipealloc(struct file **f0, struct file **f1)
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
+  (*f0)->nonblock = 0;
   (*f0)->pipe = pi;
   (*f1)->type = FD_PIPE;
   (*f1)->readable = 0;
   (*f1)->writable = 1;
+  (*f1)->nonblock = 0;
   (*f1)->pipe = pi;
   return 0;
 
@@ -66,6 +69,7 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwakeup();
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
     kfree((char*)pi);
@@ -73,8 +77,10 @@ pipeclose(struct pipe *pi, int writable)
     release(&pi->lock);
 }
 
+// Write n bytes from addr.  If nonblock, write what fits instead
+// of waiting for room, and fail if nothing does.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
   int i;
   char ch;
@@ -83,10 +89,12 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
   acquire(&pi->lock);
   for(i = 0; i < n; i++){
     while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(pi->readopen == 0 || pr->killed){
+      if(pi->readopen == 0 || pr->killed || (nonblock && i == 0)){
         release(&pi->lock);
         return -1;
       }
+      if(nonblock)
+        goto out;
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     }
@@ -94,13 +102,17 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       break;
     pi->data[pi->nwrite++ % PIPESIZE] = ch;
   }
+ out:
   wakeup(&pi->nread);
+  pollwakeup();
   release(&pi->lock);
   return i;
 }
 
+// Read up to n bytes into addr.  If nonblock, fail instead of
+// waiting for the pipe to fill.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
   int i;
   struct proc *pr = myproc();
@@ -108,7 +120,7 @@ piperead(struct pipe *pi, uint64 addr, int n)
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(pr->killed){
+    if(pr->killed || nonblock){
       release(&pi->lock);
       return -1;
     }
@@ -122,6 +134,30 @@ piperead(struct pipe *pi, uint64 addr, int n)
       break;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pollwakeup();
   release(&pi->lock);
   return i;
 }
+
+// Return which of POLLIN, POLLOUT and POLLHUP hold for the end of pi
+// that is writable or not.
+int
+pipepoll(struct pipe *pi, int writable)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  if(writable){
+    if(pi->readopen == 0)
+      r |= POLLHUP;
+    else if(pi->nwrite != pi->nread + PIPESIZE)
+      r |= POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      r |= POLLIN;
+    if(pi->writeopen == 0)
+      r |= POLLIN | POLLHUP;
+  }
+  release(&pi->lock);
+  return r;
+}
@@ -0,0 +1,10 @@
+struct pollfd {
+  int fd;         // ignored if negative
+  short events;   // requested events
+  short revents;  // returned events
+};
+
+#define POLLIN    0x001  // a read would not block
+#define POLLOUT   0x004  // a write would not block
+#define POLLHUP   0x010  // the other end of a pipe is closed
+#define POLLNVAL  0x020  // fd is not open
@@ -12,9 +12,60 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Multilevel feedback queue scheduling.
+//
+// Each CPU has a run queue per priority level; a process is on
+// one exactly while it is RUNNABLE.  It is put there with its
+// p->lock held, so p->lock comes before runq.lock.
+//
+// A process starts at its nice level and drops a level each time
+// it uses up its quantum, which doubles per level.  Sleeping
+// does not reset the count, so a process cannot keep a high
+// level by yielding just before its quantum ends.  Every
+// BOOSTTICKS all processes return to their nice level, so
+// demoted CPU-bound processes are not starved.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NQUEUE];
+  struct proc *tail[NQUEUE];
+  int n[NQUEUE];       // lengths, read without the lock as hints
+} runq[NCPU];
+
+#define QUANTUM(level) (1 << (level))
+
+int boostepoch;        // bumped by boost(), read without a lock
+
+// Sleeping processes, hashed by channel, so that wakeup()
+// looks only at processes that may be sleeping on its channel.
+// A process links itself in sleep() and unlinks itself once
+// woken; wakeup() only changes its state.  Lock order is the
+// caller's lock, then waitq.lock, then p->lock.
+#define NWAITQ 61
+#define WAITQ(chan) (&waitq[((uint64)(chan) >> 3) % NWAITQ])
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
+// Futexes sleep on the physical address of the user's word,
+// so threads sharing a page table meet on the same channel.
+// The word is checked and the sleeper queued under one of
+// these, which futex_wake() takes too.
+#define NFUTEX 31
+#define FUTEXLOCK(pa) (&futexlock[((pa) >> 2) % NFUTEX])
+
+struct spinlock futexlock[NFUTEX];
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// Address spaces shared by clone()d threads.  A process gets
+// one at its first clone(); mm.lock also serializes changes to
+// the shared page table.  Lock order is p->lock, then mm.lock.
+struct mm mm[NPROC];
+struct spinlock mm_lock;
+
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
@@ -45,6 +96,15 @@ procinit(void)
   struct proc *p;
   
   initlock(&pid_lock, "nextpid");
+  initlock(&mm_lock, "mm");
+  for(int i = 0; i < NPROC; i++)
+    initlock(&mm[i].lock, "mm");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
+  for(int i = 0; i < NFUTEX; i++)
+    initlock(&futexlock[i], "futex");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->kstack = KSTACK((int) (p - proc));
@@ -92,6 +152,146 @@ allocpid() {
   return pid;
 }
 
+// Append p to its level's list on rq.
+// Caller must hold rq->lock.
+static void
+runq_push(struct runq *rq, struct proc *p)
+{
+  int lv = p->level;
+
+  p->rqnext = 0;
+  if(rq->tail[lv])
+    rq->tail[lv]->rqnext = p;
+  else
+    rq->head[lv] = p;
+  rq->tail[lv] = p;
+  rq->n[lv]++;
+}
+
+// Highest nonempty level of rq, or NQUEUE; a hint only.
+static int
+runq_level(struct runq *rq)
+{
+  int lv;
+
+  for(lv = 0; lv < NQUEUE; lv++)
+    if(rq->n[lv])
+      return lv;
+  return NQUEUE;
+}
+
+// Take the first process of the highest level off rq, or return 0.
+static struct proc*
+runq_pop(struct runq *rq)
+{
+  struct proc *p = 0;
+  int lv;
+
+  acquire(&rq->lock);
+  for(lv = 0; lv < NQUEUE; lv++){
+    if((p = rq->head[lv]) != 0){
+      rq->head[lv] = p->rqnext;
+      if(rq->head[lv] == 0)
+        rq->tail[lv] = 0;
+      rq->n[lv]--;
+      break;
+    }
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Return p to its nice level if a boost happened since
+// its level was last set.
+// Caller must hold p->lock, and p must not be queued.
+static void
+reset_level(struct proc *p)
+{
+  if(p->epoch != boostepoch){
+    p->level = p->nice;
+    p->slice = 0;
+    p->epoch = boostepoch;
+  }
+}
+
+// Mark p RUNNABLE and queue it on this CPU; idle CPUs
+// steal from busy ones.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *rq;
+
+  if(!holding(&p->lock))
+    panic("setrunnable");
+  p->state = RUNNABLE;
+  reset_level(p);
+  rq = &runq[cpuid()];
+  acquire(&rq->lock);
+  runq_push(rq, p);
+  release(&rq->lock);
+}
+
+// Charge a timer tick to the current process, if any.
+// Returns 1 if it should yield: it used up its quantum,
+// or a process of a higher level is waiting on some CPU.
+int
+proctick(void)
+{
+  struct proc *p = myproc();
+  int i, preempt = 0;
+
+  if(p == 0)
+    return 0;
+  acquire(&p->lock);
+  if(p->state == RUNNING){
+    p->cputicks++;
+    reset_level(p);
+    if(p->level < p->nice)
+      p->level = p->nice;
+    if(++p->slice >= QUANTUM(p->level)){
+      if(p->level < NQUEUE-1)
+        p->level++;
+      p->slice = 0;
+      preempt = 1;
+    }
+    for(i = 0; i < NCPU && !preempt; i++)
+      if(runq_level(&runq[i]) < p->level)
+        preempt = 1;
+  }
+  release(&p->lock);
+  return preempt;
+}
+
+// Move every queued process back to its nice level, and make
+// the others go back when next charged or queued.
+// Called by clockintr() every BOOSTTICKS.
+void
+boost(void)
+{
+  struct runq *rq;
+  struct proc *p, *list;
+  int lv;
+
+  __sync_fetch_and_add(&boostepoch, 1);
+  for(rq = runq; rq < &runq[NCPU]; rq++){
+    acquire(&rq->lock);
+    for(lv = 1; lv < NQUEUE; lv++){
+      list = rq->head[lv];
+      rq->head[lv] = rq->tail[lv] = 0;
+      rq->n[lv] = 0;
+      while((p = list) != 0){
+        list = p->rqnext;
+        p->level = p->nice;
+        p->slice = 0;
+        p->epoch = boostepoch;
+        runq_push(rq, p);
+      }
+    }
+    release(&rq->lock);
+  }
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
@@ -134,6 +334,15 @@ found:
   p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
 
+  // Alarms are not inherited.
+  p->alarmticks = 0;
+  p->alarmmasked = 0;
+
+  p->tfva = TRAPFRAME;
+  p->mm = 0;
+  p->isthread = 0;
+  p->ofile = p->fdtab;
+
   return p;
 }
 
@@ -143,12 +352,16 @@ found:
 static void
 freeproc(struct proc *p)
 {
+  // Unmap the trapframe before freeing it: a shared page table
+  // stays live for the other threads.
+  if(p->mm)
+    mmput(p, p->pagetable);
+  else if(p->pagetable)
+    proc_freepagetable(p->pagetable, p->sz);
+  p->pagetable = 0;
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
@@ -202,6 +415,79 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
   uvmfree(pagetable, sz);
 }
 
+// Give p, which is about to clone(), an mm for its address space.
+static int
+mmalloc(struct proc *p)
+{
+  struct mm *m;
+
+  acquire(&mm_lock);
+  for(m = mm; m < &mm[NPROC]; m++){
+    if(m->ref == 0){
+      m->ref = 1;
+      m->sz = p->sz;
+      m->slots = 1;
+      m->exiting = 0;
+      m->xstate = 0;
+      release(&mm_lock);
+      // The threads share one file table, like the page table.
+      memmove(m->ofile, p->fdtab, sizeof(m->ofile));
+      memset(p->fdtab, 0, sizeof(p->fdtab));
+      m->nfile = 1;
+      p->ofile = m->ofile;
+      p->mm = m;
+      return 0;
+    }
+  }
+  release(&mm_lock);
+  return -1;
+}
+
+// Drop p's share of the address space in pagetable, and free
+// it with the last reference.
+void
+mmput(struct proc *p, pagetable_t pagetable)
+{
+  struct mm *m = p->mm;
+  uint64 sz;
+  int last;
+
+  acquire(&m->lock);
+  // exec() by the only thread takes the files back.
+  if(p->ofile == m->ofile){
+    memmove(p->fdtab, m->ofile, sizeof(p->fdtab));
+    memset(m->ofile, 0, sizeof(m->ofile));
+    p->ofile = p->fdtab;
+  }
+  uvmunmap(pagetable, p->tfva, 1, 0);
+  m->slots &= ~(1 << ((TRAPFRAME - p->tfva) / PGSIZE));
+  sz = m->sz;
+  p->mm = 0;
+  p->isthread = 0;
+  p->tfva = TRAPFRAME;
+  last = (m->ref == 1);
+  m->ref--;
+  release(&m->lock);
+
+  if(last){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, sz);
+  }
+}
+
+// Set the size of a shared address space in every thread.
+// Caller must hold m->lock.
+static void
+mmsetsz(struct mm *m, uint64 sz)
+{
+  struct proc *q;
+
+  m->sz = sz;
+  for(q = proc; q < &proc[NPROC]; q++)
+    if(q->mm == m)
+      q->sz = sz;
+}
+
 // a user program that calls exec("/init")
 // od -t xC initcode
 uchar initcode[] = {
@@ -233,30 +519,50 @@ userinit(void)
   p->trapframe->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
+  p->nice = 0;
+  p->cputicks = 0;
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
-// Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Grow or shrink user memory by n bytes, and set *oldsz to
+// the size before.  Return 0 on success, -1 on failure.
 int
-growproc(int n)
+growproc(int n, uint64 *oldsz)
 {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
+  struct mm *m = p->mm;
 
-  sz = p->sz;
+  if(m)
+    acquire(&m->lock);
+  sz = *oldsz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    // Stay below the threads' trapframes.
+    if(sz + n > TRAPFRAME - NTHREAD*PGSIZE ||
+       (sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+      if(m)
+        release(&m->lock);
       return -1;
     }
   } else if(n < 0){
+    // Other threads may have the pages in their TLBs, and
+    // there is no shootdown to flush them.
+    if(m && m->ref > 1){
+      release(&m->lock);
+      return -1;
+    }
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
-  p->sz = sz;
+  if(m){
+    mmsetsz(m, sz);
+    release(&m->lock);
+  } else {
+    p->sz = sz;
+  }
   return 0;
 }
 
@@ -275,12 +581,18 @@ fork(void)
   }
 
   // Copy user memory from parent to child.
+  if(p->mm)
+    acquire(&p->mm->lock);
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+    if(p->mm)
+      release(&p->mm->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
+  if(p->mm)
+    release(&p->mm->lock);
 
   np->parent = p;
 
@@ -291,22 +603,131 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
+  if(p->mm)
+    acquire(&p->mm->lock);
   for(i = 0; i < NOFILE; i++)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
+  if(p->mm)
+    release(&p->mm->lock);
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  // The child starts fresh at the parent's nice level.
+  np->nice = p->nice;
+  np->epoch = boostepoch - 1;
+  np->cputicks = 0;
+
   pid = np->pid;
 
-  np->state = RUNNABLE;
+  setrunnable(np);
 
   release(&np->lock);
 
   return pid;
 }
 
+// Create a thread that shares the caller's address space and
+// starts at fn(arg) on stack.  The threads share one file table;
+// the cwd is shared by reference, as in fork().  The thread is a
+// child of the caller.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int pid, slot;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct mm *m;
+
+  if(p->mm == 0 && mmalloc(p) < 0)
+    return -1;
+  m = p->mm;
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  // Trade the fresh page table for a slot in the shared one.
+  proc_freepagetable(np->pagetable, 0);
+  np->pagetable = 0;
+  acquire(&m->lock);
+  for(slot = 1; slot <= NTHREAD; slot++)
+    if((m->slots & (1 << slot)) == 0)
+      break;
+  if(slot > NTHREAD || m->exiting ||
+     mappages(p->pagetable, TRAPFRAME - slot*PGSIZE, PGSIZE,
+              (uint64)np->trapframe, PTE_R | PTE_W) != 0){
+    release(&m->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  m->slots |= 1 << slot;
+  m->ref++;
+  m->nfile++;
+  np->ofile = m->ofile;
+  np->pagetable = p->pagetable;
+  np->sz = m->sz;
+  np->tfva = TRAPFRAME - slot*PGSIZE;
+  np->mm = m;
+  np->isthread = 1;
+  release(&m->lock);
+
+  np->parent = p;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack;
+  np->trapframe->a0 = arg;
+  np->trapframe->ra = 0;
+
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  np->nice = p->nice;
+  np->epoch = boostepoch - 1;
+  np->cputicks = 0;
+
+  pid = np->pid;
+
+  setrunnable(np);
+
+  release(&np->lock);
+
+  return pid;
+}
+
+// exit() of one thread ends them all, with the status of the
+// first to call it.  Kill the others and return that status.
+static int
+mmexit(struct proc *p, int status)
+{
+  struct mm *m = p->mm;
+  struct proc *q;
+
+  acquire(&m->lock);
+  if(!m->exiting){
+    m->exiting = 1;
+    m->xstate = status;
+  }
+  status = m->xstate;
+  release(&m->lock);
+
+  for(q = proc; q < &proc[NPROC]; q++){
+    if(q == p)
+      continue;
+    acquire(&q->lock);
+    if(q->mm == m && q->state != ZOMBIE){
+      q->killed = 1;
+      if(q->state == SLEEPING)
+        setrunnable(q);
+    }
+    release(&q->lock);
+  }
+  return status;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold p->lock.
 void
@@ -340,16 +761,27 @@ void
 exit(int status)
 {
   struct proc *p = myproc();
+  struct file **ofile = p->ofile;
+  int last = 1;
 
   if(p == initproc)
     panic("init exiting");
 
+  if(p->mm){
+    status = mmexit(p, status);
+    // A shared file table is closed by the last thread out.
+    acquire(&p->mm->lock);
+    last = (--p->mm->nfile == 0);
+    release(&p->mm->lock);
+    p->ofile = p->fdtab;
+  }
+
   // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
+  for(int fd = 0; last && fd < NOFILE; fd++){
+    if(ofile[fd]){
+      struct file *f = ofile[fd];
       fileclose(f);
-      p->ofile[fd] = 0;
+      ofile[fd] = 0;
     }
   }
 
@@ -465,28 +897,51 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  struct runq *rq, *src;
+  int id = c - cpus;
+  int i, lv, best;
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
+    // Run the highest level queued anywhere, preferring our
+    // own queue on a tie; otherwise steal from another CPU.
+    best = NQUEUE;
+    src = 0;
+    for(i = 0; i < NCPU; i++){
+      rq = &runq[(id + i) % NCPU];
+      if((lv = runq_level(rq)) < best){
+        best = lv;
+        src = rq;
       }
-      release(&p->lock);
     }
+    if(src == 0){
+      // Nothing runnable.  Idle until an interrupt; a process
+      // queued meanwhile by another CPU is picked up no later
+      // than the next timer tick.
+      wfi();
+      continue;
+    }
+    // Another CPU may have emptied src since we looked.
+    if((p = runq_pop(src)) == 0)
+      continue;
+
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: queued process not runnable");
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    c->proc = p;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -523,7 +978,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -555,21 +1010,31 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct proc **pp;
+  struct waitq *wq = 0;
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold chan's wait queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks it before looking at p),
   // so it's okay to release lk.
+  // A sleeper on its own p->lock (wait()) is not
+  // hashed: only wakeup1() and kill() wake it.
   if(lk != &p->lock){  //DOC: sleeplock0
+    wq = WAITQ(chan);
+    acquire(&wq->lock);
     acquire(&p->lock);  //DOC: sleeplock1
     release(lk);
+    p->wqnext = wq->head;
+    wq->head = p;
   }
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  if(wq)
+    release(&wq->lock);
 
   sched();
 
@@ -579,6 +1044,14 @@ sleep(void *chan, struct spinlock *lk)
   // Reacquire original lock.
   if(lk != &p->lock){
     release(&p->lock);
+    acquire(&wq->lock);
+    for(pp = &wq->head; *pp; pp = &(*pp)->wqnext){
+      if(*pp == p){
+        *pp = p->wqnext;
+        break;
+      }
+    }
+    release(&wq->lock);
     acquire(lk);
   }
 }
@@ -588,15 +1061,124 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
+  struct waitq *wq = WAITQ(chan);
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = p->wqnext) {
     acquire(&p->lock);
     if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+      setrunnable(p);
     }
     release(&p->lock);
   }
+  release(&wq->lock);
+}
+
+// Wake up the process that has slept longest on chan, for
+// waits where only one waiter can make progress (a sleep lock,
+// a log slot).  Must be called without any p->lock.
+void
+wakeup_one(void *chan)
+{
+  struct waitq *wq = WAITQ(chan);
+  struct proc *p, *oldest = 0;
+
+  acquire(&wq->lock);
+  // Sleepers are linked newest first.  One already woken but not
+  // yet off the queue would take the wakeup without using it.
+  for(p = wq->head; p; p = p->wqnext)
+    if(p->chan == chan && p->state == SLEEPING)
+      oldest = p;
+  if(oldest){
+    acquire(&oldest->lock);
+    if(oldest->state == SLEEPING && oldest->chan == chan)
+      setrunnable(oldest);
+    release(&oldest->lock);
+  }
+  release(&wq->lock);
+}
+
+// Wake up to n processes sleeping on chan, those that have
+// slept longest first.  Returns the number woken.
+// Must be called without any p->lock.
+int
+wakeup_n(void *chan, int n)
+{
+  struct waitq *wq = WAITQ(chan);
+  struct proc *p, *oldest;
+  int woken = 0;
+
+  acquire(&wq->lock);
+  while(woken < n){
+    // Sleepers are linked newest first.
+    oldest = 0;
+    for(p = wq->head; p; p = p->wqnext)
+      if(p->chan == chan && p->state == SLEEPING)
+        oldest = p;
+    if(oldest == 0)
+      break;
+    acquire(&oldest->lock);
+    if(oldest->state == SLEEPING && oldest->chan == chan){
+      setrunnable(oldest);
+      woken++;
+    }
+    release(&oldest->lock);
+  }
+  release(&wq->lock);
+  return woken;
+}
+
+// Physical address of the user int at uaddr, or 0.
+static uint64
+futexaddr(uint64 uaddr)
+{
+  uint64 pa;
+
+  if(uaddr % sizeof(int) != 0)
+    return 0;
+  if((pa = walkaddr(myproc()->pagetable, PGROUNDDOWN(uaddr))) == 0)
+    return 0;
+  return pa + (uaddr - PGROUNDDOWN(uaddr));
+}
+
+// Sleep until futex_wake() on uaddr, if the int there is val.
+// Returns 0 once woken, -1 if it was not val.
+int
+futex_wait(uint64 uaddr, int val)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  uint64 pa;
+
+  if((pa = futexaddr(uaddr)) == 0)
+    return -1;
+  lk = FUTEXLOCK(pa);
+  acquire(lk);
+  if(*(volatile int*)pa != val || p->killed){
+    release(lk);
+    return -1;
+  }
+  sleep((void*)pa, lk);
+  release(lk);
+  return 0;
+}
+
+// Wake up to n processes waiting on uaddr.
+// Returns the number woken, or -1.
+int
+futex_wake(uint64 uaddr, int n)
+{
+  struct spinlock *lk;
+  uint64 pa;
+
+  if((pa = futexaddr(uaddr)) == 0)
+    return -1;
+  lk = FUTEXLOCK(pa);
+  acquire(lk);
+  n = wakeup_n((void*)pa, n);
+  release(lk);
+  return n;
 }
 
 // Wake up p if it is sleeping in wait(); used by exit().
@@ -607,7 +1189,7 @@ wakeup1(struct proc *p)
   if(!holding(&p->lock))
     panic("wakeup1");
   if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
+    setrunnable(p);
   }
 }
 
@@ -625,7 +1207,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
       return 0;
@@ -635,6 +1217,54 @@ kill(int pid)
   return -1;
 }
 
+// Set the highest MLFQ level process pid may run at;
+// 0 is the highest.  Returns the old value, or -1.
+int
+setpriority(int pid, int prio)
+{
+  struct proc *p;
+  int old;
+
+  if(prio < 0 || prio >= NQUEUE)
+    return -1;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      old = p->nice;
+      p->nice = prio;
+      // A queued process moves at its next tick or boost.
+      if(p->state != RUNNABLE){
+        p->level = prio;
+        p->slice = 0;
+      }
+      release(&p->lock);
+      return old;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Return the timer ticks process pid has spent running,
+// or -1 if there is no such process.
+int
+cputime(int pid)
+{
+  struct proc *p;
+  int t;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      t = p->cputicks;
+      release(&p->lock);
+      return t;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
 // Copy to either a user address, or kernel address,
 // depending on usr_dst.
 // Returns 0 on success, -1 on error.
@@ -689,7 +1319,8 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %s level %d/%d cpu %d", p->pid, state, p->name,
+           p->level, p->nice, p->cputicks);
     printf("\n");
   }
 }
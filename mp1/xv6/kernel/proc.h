@@ -80,6 +80,20 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// An address space shared by clone()d threads.  The threads
+// all point p->pagetable at the same page table and map their
+// trapframes at TRAPFRAME - slot*PGSIZE; the leader keeps slot 0.
+struct mm {
+  struct spinlock lock;
+  int ref;                     // procs using the page table
+  uint64 sz;                   // size of the shared memory, mirrored in p->sz
+  int slots;                   // trapframe slots in use, one bit each
+  int exiting;                 // one thread called exit() for all
+  int xstate;                  // its status
+  struct file *ofile[NOFILE];  // open files of all the threads
+  int nfile;                   // threads using ofile, not yet exited
+};
+
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -94,13 +108,35 @@ struct proc {
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
 
+  // p->lock, or the run queue's lock while RUNNABLE:
+  struct proc *rqnext;         // Next on a run queue
+  int level;                   // MLFQ level, 0 is the highest
+  int slice;                   // Ticks used at this level
+  int epoch;                   // boostepoch when level was last reset
+
+  // the wait queue's lock must be held when using this:
+  struct proc *wqnext;         // Next on a wait queue, in sleep()
+
+  int nice;                    // Highest level allowed, set by setpriority()
+  int cputicks;                // Timer ticks spent running
+
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // where trapframe is mapped, TRAPFRAME unless a thread
+  struct mm *mm;               // shared address space, 0 until clone()
+  int isthread;                // created by clone()
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct file **ofile;         // Open files: fdtab, or the mm's
+  struct file *fdtab[NOFILE];  // Open files until clone()
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+
+  // sigalarm(), also private to the process:
+  int alarmticks;              // Alarm interval in ticks, 0 if off
+  int alarmleft;               // Ticks left until the next alarm
+  int alarmmasked;             // Alarm delivered, handler not yet done
+  uint64 alarmhandler;         // User address of the handler
 };
@@ -0,0 +1,114 @@
+// Reader-writer spin locks.
+//
+// Any number of readers, or one writer.  A waiting writer stops
+// new readers from coming in, so a steady stream of readers cannot
+// starve it.  Like spinlocks, these are held with interrupts off,
+// and a CPU must not take the read lock twice: a writer waiting in
+// between would deadlock it.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "lockstat.h"
+
+void
+initrwlock(struct rwlock *lk, char *name)
+{
+  lk->state = 0;
+  lk->name = name;
+#ifdef LOCKSTAT
+  lk->stat = lockclass(name, 0);
+#endif
+}
+
+// Clock for the lock statistics.
+static uint64
+rwclock(void)
+{
+#ifdef LOCKSTAT
+  return r_time();
+#else
+  return 0;
+#endif
+}
+
+// Count an acquisition of lk, asked for at time t0.
+static void
+rwstat(struct rwlock *lk, uint64 t0, int contended)
+{
+#ifdef LOCKSTAT
+  if(lk->stat == 0)
+    return;
+  __sync_fetch_and_add(&lk->stat->nacquire, 1);
+  if(contended){
+    __sync_fetch_and_add(&lk->stat->ncontend, 1);
+    __sync_fetch_and_add(&lk->stat->wait, r_time() - t0);
+  }
+#endif
+}
+
+void
+acquireread(struct rwlock *lk)
+{
+  uint s;
+  int contended = 0;
+  uint64 t0 = rwclock();
+
+  push_off();
+  for(;;){
+    s = __atomic_load_n(&lk->state, __ATOMIC_RELAXED);
+    if((s & (RW_WRITER | RW_WAITING)) == 0 &&
+       __sync_bool_compare_and_swap(&lk->state, s, s + 1))
+      break;
+    contended = 1;
+  }
+  __sync_synchronize();
+  rwstat(lk, t0, contended);
+}
+
+void
+releaseread(struct rwlock *lk)
+{
+  if((lk->state & ~(RW_WRITER | RW_WAITING)) == 0)
+    panic("releaseread");
+  __sync_synchronize();
+  __sync_fetch_and_sub(&lk->state, 1);
+  pop_off();
+}
+
+void
+acquirewrite(struct rwlock *lk)
+{
+  uint s;
+  int contended = 0;
+  uint64 t0 = rwclock();
+
+  push_off();
+  for(;;){
+    s = __atomic_load_n(&lk->state, __ATOMIC_RELAXED);
+    if((s & ~RW_WAITING) == 0){
+      // Free.  Taking it clears RW_WAITING; any other waiting
+      // writer sets it again on its next try.
+      if(__sync_bool_compare_and_swap(&lk->state, s, RW_WRITER))
+        break;
+    } else if((s & RW_WAITING) == 0){
+      __sync_bool_compare_and_swap(&lk->state, s, s | RW_WAITING);
+    }
+    contended = 1;
+  }
+  __sync_synchronize();
+  rwstat(lk, t0, contended);
+}
+
+void
+releasewrite(struct rwlock *lk)
+{
+  if((lk->state & RW_WRITER) == 0)
+    panic("releasewrite");
+  __sync_synchronize();
+  __sync_fetch_and_and(&lk->state, ~RW_WRITER);
+  pop_off();
+}
@@ -0,0 +1,15 @@
+// Reader-writer spin locks, for data that is read far more
+// often than it is changed.
+struct rwlock {
+  uint state;        // RW_WRITER | RW_WAITING | number of readers
+
+  // For debugging:
+  char *name;        // Name of lock.
+
+#ifdef LOCKSTAT
+  struct lockstat *stat; // Statistics for this lock's name, or 0.
+#endif
+};
+
+#define RW_WRITER  0x80000000  // a writer holds the lock
+#define RW_WAITING 0x40000000  // a writer is waiting; keep new readers out
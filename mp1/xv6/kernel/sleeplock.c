@@ -8,6 +8,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "sleeplock.h"
+#include "lockstat.h"
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
@@ -16,17 +17,36 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+#ifdef LOCKSTAT
+  lk->stat = lockclass(name, 1);
+#endif
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+#ifdef LOCKSTAT
+  if(lk->locked && lk->stat){
+    uint64 t0 = r_time();
+    while (lk->locked) {
+      sleep(lk, &lk->lk);
+    }
+    __sync_fetch_and_add(&lk->stat->ncontend, 1);
+    __sync_fetch_and_add(&lk->stat->wait, r_time() - t0);
+  }
+#endif
   while (lk->locked) {
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+#ifdef LOCKSTAT
+  if(lk->stat){
+    __sync_fetch_and_add(&lk->stat->nacquire, 1);
+    lk->tacquire = r_time();
+  }
+#endif
   release(&lk->lk);
 }
 
@@ -34,9 +54,13 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+#ifdef LOCKSTAT
+  if(lk->stat)
+    lockstat_hold(lk->stat, lk->tacquire);
+#endif
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  wakeup_one(lk);
   release(&lk->lk);
 }
 
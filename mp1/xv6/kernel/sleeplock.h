@@ -6,5 +6,10 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+#ifdef LOCKSTAT
+  struct lockstat *stat; // Statistics for this lock's name, or 0.
+  uint64 tacquire;       // When it was acquired.
+#endif
 };
 
@@ -7,6 +7,70 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
+
+#ifdef LOCKSTAT
+// Statistics are kept per lock name rather than per lock, so
+// that locks which come and go (pipes) or come in arrays (proc,
+// buffers) add up to one line, and no entry outlives its lock.
+#define NLOCKSTAT 64
+
+struct lockstat lockstats[NLOCKSTAT];
+int nlockstat;
+struct spinlock statlock;  // never initlock()ed: no stats of its own
+
+// Return the statistics entry for name, creating it if needed,
+// or 0 if the table is full.
+struct lockstat*
+lockclass(char *name, int sleep)
+{
+  struct lockstat *st;
+
+  acquire(&statlock);
+  for(st = lockstats; st < &lockstats[nlockstat]; st++)
+    if(st->sleep == sleep && strncmp(st->name, name, sizeof(st->name)-1) == 0)
+      goto found;
+  st = 0;
+  if(nlockstat < NLOCKSTAT){
+    st = &lockstats[nlockstat++];
+    safestrcpy(st->name, name, sizeof(st->name));
+    st->sleep = sleep;
+  }
+found:
+  release(&statlock);
+  return st;
+}
+
+// Record that a lock was held from t0 until now.
+void
+lockstat_hold(struct lockstat *st, uint64 t0)
+{
+  uint64 t = r_time() - t0;
+
+  // Racy between CPUs holding different locks of one name,
+  // which is good enough for a maximum.
+  if(t > st->maxhold)
+    st->maxhold = t;
+}
+#endif
+
+// Copy up to n lock statistics entries to user address addr.
+// Returns the number copied, or -1 if not built with LOCKSTAT.
+int
+lockstat_copyout(uint64 addr, int n)
+{
+#ifdef LOCKSTAT
+  int i;
+
+  for(i = 0; i < n && i < nlockstat; i++)
+    if(copyout(myproc()->pagetable, addr + i*sizeof(struct lockstat),
+               (char*)&lockstats[i], sizeof(struct lockstat)) < 0)
+      return -1;
+  return i;
+#else
+  return -1;
+#endif
+}
 
 void
 initlock(struct spinlock *lk, char *name)
@@ -14,6 +78,48 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->ticket = 0;
+  lk->next = 0;
+  lk->serving = 0;
+#ifdef LOCKSTAT
+  lk->stat = lockclass(name, 0);
+#endif
+}
+
+// Initialize a lock that is granted in the order CPUs ask for it.
+// Waiters spin reading lk->serving rather than swapping lk->locked,
+// so a busy lock neither starves a CPU nor bounces its cache line
+// between the waiters.  Meant for heavily shared locks.
+void
+initticketlock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  lk->ticket = 1;
+}
+
+// Wait for a lock that was busy at the first try: until ticket t
+// is served, or until the test-and-set succeeds.
+static void
+spin(struct spinlock *lk, uint t)
+{
+#ifdef LOCKSTAT
+  uint64 t0 = r_time();
+#endif
+
+  if(lk->ticket){
+    while(__atomic_load_n(&lk->serving, __ATOMIC_RELAXED) != t)
+      ;
+  } else {
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      ;
+  }
+
+#ifdef LOCKSTAT
+  if(lk->stat){
+    __sync_fetch_and_add(&lk->stat->ncontend, 1);
+    __sync_fetch_and_add(&lk->stat->wait, r_time() - t0);
+  }
+#endif
 }
 
 // Acquire the lock.
@@ -21,6 +127,8 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint t;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
@@ -29,8 +137,15 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  // A ticket lock instead takes a ticket with amoadd.w.
+  if(lk->ticket){
+    t = __sync_fetch_and_add(&lk->next, 1);
+    if(__atomic_load_n(&lk->serving, __ATOMIC_RELAXED) != t)
+      spin(lk, t);
+    lk->locked = 1;
+  } else if(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    spin(lk, 0);
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +155,12 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+#ifdef LOCKSTAT
+  if(lk->stat){
+    __sync_fetch_and_add(&lk->stat->nacquire, 1);
+    lk->tacquire = r_time();
+  }
+#endif
 }
 
 // Release the lock.
@@ -49,6 +170,10 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+#ifdef LOCKSTAT
+  if(lk->stat)
+    lockstat_hold(lk->stat, lk->tacquire);
+#endif
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -66,7 +191,14 @@ release(struct spinlock *lk)
   // On RISC-V, sync_lock_release turns into an atomic swap:
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // A ticket lock is passed on to the next ticket instead;
+  // its locked field only serves holding().
+  if(lk->ticket){
+    lk->locked = 0;
+    __atomic_store_n(&lk->serving, lk->serving + 1, __ATOMIC_RELEASE);
+  } else {
+    __sync_lock_release(&lk->locked);
+  }
 
   pop_off();
 }
@@ -2,8 +2,18 @@
 struct spinlock {
   uint locked;       // Is the lock held?
 
+  // Ticket locks (initticketlock()) are granted in FIFO order.
+  int ticket;        // Is this a ticket lock?
+  uint next;         // Next ticket to hand out.
+  uint serving;      // Ticket now allowed to hold the lock.
+
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+#ifdef LOCKSTAT
+  struct lockstat *stat; // Statistics for this lock's name, or 0.
+  uint64 tacquire;       // When it was acquired.
+#endif
 };
 
@@ -20,3 +20,13 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_setpriority 22
+#define SYS_cputime 23
+#define SYS_lockstat 24
+#define SYS_sigalarm 25
+#define SYS_sigreturn 26
+#define SYS_clone  27
+#define SYS_futex_wait 28
+#define SYS_futex_wake 29
+#define SYS_fcntl  30
+#define SYS_poll   31
@@ -15,9 +15,52 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "poll.h"
+
+// A file table shared by clone()d threads is guarded by the
+// mm's lock, and a file taken from it is held by a reference of
+// its own, so that a close() by another thread cannot free it
+// while in use.  fdput() drops that reference.
+static void
+fdlock(struct proc *p)
+{
+  if(p->mm)
+    acquire(&p->mm->lock);
+}
+
+static void
+fdunlock(struct proc *p)
+{
+  if(p->mm)
+    release(&p->mm->lock);
+}
+
+// Return the file open as fd, or 0.  Drop it with fdput().
+static struct file*
+fdget(int fd)
+{
+  struct file *f;
+  struct proc *p = myproc();
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  fdlock(p);
+  if((f = p->ofile[fd]) != 0 && p->mm)
+    filedup(f);
+  fdunlock(p);
+  return f;
+}
+
+static void
+fdput(struct file *f)
+{
+  if(myproc()->mm)
+    fileclose(f);
+}
 
 // Fetch the nth word-sized system call argument as a file descriptor
-// and return both the descriptor and the corresponding struct file.
+// and return both the descriptor and the corresponding struct file,
+// to be dropped with fdput().
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
@@ -26,12 +69,14 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f = fdget(fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
   if(pf)
     *pf = f;
+  else
+    fdput(f);
   return 0;
 }
 
@@ -43,15 +88,35 @@ fdalloc(struct file *f)
   int fd;
   struct proc *p = myproc();
 
+  fdlock(p);
   for(fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd] == 0){
       p->ofile[fd] = f;
+      fdunlock(p);
       return fd;
     }
   }
+  fdunlock(p);
   return -1;
 }
 
+// Free descriptor fd if it still refers to f, as it may not
+// if another thread closed it.  Returns 0 if it did not.
+static int
+fdfree(int fd, struct file *f)
+{
+  int r = 0;
+  struct proc *p = myproc();
+
+  fdlock(p);
+  if(p->ofile[fd] == f){
+    p->ofile[fd] = 0;
+    r = 1;
+  }
+  fdunlock(p);
+  return r;
+}
+
 uint64
 sys_dup(void)
 {
@@ -60,9 +125,10 @@ sys_dup(void)
 
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
-    return -1;
   filedup(f);
+  if((fd=fdalloc(f)) < 0)
+    fileclose(f);
+  fdput(f);
   return fd;
 }
 
@@ -73,9 +139,11 @@ sys_read(void)
   int n;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  n = fileread(f, p, n);
+  fdput(f);
+  return n;
 }
 
 uint64
@@ -85,10 +153,11 @@ sys_write(void)
   int n;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-
-  return filewrite(f, p, n);
+  n = filewrite(f, p, n);
+  fdput(f);
+  return n;
 }
 
 uint64
@@ -99,7 +168,11 @@ sys_close(void)
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  if(!fdfree(fd, f)){
+    fdput(f);
+    return -1;
+  }
+  fdput(f);
   fileclose(f);
   return 0;
 }
@@ -110,9 +183,13 @@ sys_fstat(void)
   struct file *f;
   uint64 st; // user pointer to struct stat
 
-  if(argfd(0, 0, &f) < 0 || argaddr(1, &st) < 0)
+  int r;
+
+  if(argaddr(1, &st) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, st);
+  fdput(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -322,9 +399,7 @@ sys_open(void)
     return -1;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
     return -1;
@@ -340,6 +415,7 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -348,6 +424,10 @@ sys_open(void)
   iunlock(ip);
   end_op();
 
+  // Only a finished file goes in the table, where other
+  // threads may see it.
+  if((fd = fdalloc(f)) < 0)
+    fileclose(f);
   return fd;
 }
 
@@ -468,19 +548,99 @@ sys_pipe(void)
     return -1;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
-    if(fd0 >= 0)
-      p->ofile[fd0] = 0;
-    fileclose(rf);
+    if(fd0 < 0 || fdfree(fd0, rf))
+      fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
-    fileclose(rf);
-    fileclose(wf);
+    if(fdfree(fd0, rf))
+      fileclose(rf);
+    if(fdfree(fd1, wf))
+      fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg, r;
+
+  if(argint(1, &cmd) < 0 || argint(2, &arg) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETFL:
+    r = f->readable ? (f->writable ? O_RDWR : O_RDONLY) : O_WRONLY;
+    r |= f->nonblock ? O_NONBLOCK : 0;
+    break;
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    r = 0;
+    break;
+  default:
+    r = -1;
+  }
+  fdput(f);
+  return r;
+}
+
+// Wait until one of nfds descriptors is ready for the events it
+// asks for, or timeout ticks pass; a negative timeout waits
+// forever and 0 does not wait.  Returns the number of ready
+// descriptors, with each one's revents set.
+uint64
+sys_poll(void)
+{
+  struct pollfd fds[NOFILE];
+  struct proc *p = myproc();
+  struct file *f;
+  uint64 addr;
+  uint t0;
+  int nfds, timeout, timed, i, n, seq;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &nfds) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  if(nfds < 0 || nfds > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, addr, nfds*sizeof(fds[0])) < 0)
+    return -1;
+
+  acquire(&tickslock);
+  t0 = ticks;
+  release(&tickslock);
+  timed = timeout > 0;
+  pollenter(timed);
+  for(;;){
+    seq = pollseq();
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if((f = fdget(fds[i].fd)) == 0)
+        fds[i].revents = POLLNVAL;
+      else {
+        fds[i].revents = fileready(f, fds[i].events);
+        fdput(f);
+      }
+      if(fds[i].revents)
+        n++;
+    }
+    if(n > 0 || timeout == 0 || p->killed)
+      break;
+    if(timed && ticks - t0 >= timeout)
+      break;
+    pollsleep(seq);
+  }
+  pollexit(timed);
+
+  if(p->killed)
+    return -1;
+  if(copyout(p->pagetable, addr, (char*)fds, nfds*sizeof(fds[0])) < 0)
+    return -1;
+  return n;
+}
@@ -41,13 +41,12 @@ sys_wait(void)
 uint64
 sys_sbrk(void)
 {
-  int addr;
+  uint64 addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if(growproc(n, &addr) < 0)
     return -1;
   return addr;
 }
@@ -95,3 +94,95 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+uint64
+sys_setpriority(void)
+{
+  int pid, prio;
+
+  if(argint(0, &pid) < 0 || argint(1, &prio) < 0)
+    return -1;
+  return setpriority(pid, prio);
+}
+
+uint64
+sys_cputime(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return cputime(pid);
+}
+
+// Copy lock contention statistics to the user.
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return lockstat_copyout(addr, n);
+}
+
+// Call handler every ticks timer ticks of user time,
+// or never if ticks is 0.  Also ends a masked alarm.
+uint64
+sys_sigalarm(void)
+{
+  struct proc *p = myproc();
+  int n;
+  uint64 handler;
+
+  if(argint(0, &n) < 0 || argaddr(1, &handler) < 0 || n < 0)
+    return -1;
+  p->alarmticks = n;
+  p->alarmleft = n;
+  p->alarmhandler = handler;
+  p->alarmmasked = 0;
+  return 0;
+}
+
+uint64
+sys_sigreturn(void)
+{
+  uint64 frame;
+
+  if(argaddr(0, &frame) < 0)
+    return -1;
+  return sigreturn(frame);
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futex_wait(addr, val);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futex_wake(addr, n);
+}
@@ -19,7 +19,7 @@ extern int devintr();
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  initticketlock(&tickslock, "time");
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -29,6 +29,56 @@ trapinithart(void)
   w_stvec((uint64)kernelvec);
 }
 
+// Count a timer tick spent in user space against p's alarm, and
+// deliver the alarm if it is due: push the user registers onto
+// the user stack and enter the handler with a pointer to them.
+// The handler gets no further alarms until it calls sigreturn()
+// on that pointer, or sigalarm() again.
+static void
+alarmtick(struct proc *p)
+{
+  struct trapframe f, *tf = p->trapframe;
+  uint64 sp;
+
+  if(p->alarmticks == 0 || p->alarmmasked || --p->alarmleft > 0)
+    return;
+  p->alarmleft = p->alarmticks;
+
+  // The kernel's fields are of no use to the handler.
+  f = *tf;
+  f.kernel_satp = f.kernel_sp = f.kernel_trap = f.kernel_hartid = 0;
+  sp = (tf->sp - sizeof(f)) & ~0xfL;
+  if(copyout(p->pagetable, sp, (char*)&f, sizeof(f)) < 0){
+    p->killed = 1;
+    return;
+  }
+  tf->sp = sp;
+  tf->a0 = sp;
+  tf->ra = 0;  // the handler must not return
+  tf->epc = p->alarmhandler;
+  p->alarmmasked = 1;
+}
+
+// Return from an alarm handler to the user registers
+// saved at frame.  Returns the restored a0, so that
+// the system call return leaves it in place.
+uint64
+sigreturn(uint64 frame)
+{
+  struct proc *p = myproc();
+  struct trapframe f, *tf = p->trapframe;
+
+  if(copyin(p->pagetable, (char*)&f, frame, sizeof(f)) < 0)
+    return -1;
+  f.kernel_satp = tf->kernel_satp;
+  f.kernel_sp = tf->kernel_sp;
+  f.kernel_trap = tf->kernel_trap;
+  f.kernel_hartid = tf->kernel_hartid;
+  *tf = f;
+  p->alarmmasked = 0;
+  return tf->a0;
+}
+
 //
 // handle an interrupt, exception, or system call from user space.
 // called from trampoline.S
@@ -76,8 +126,14 @@ usertrap(void)
   if(p->killed)
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  if(which_dev == 2){
+    alarmtick(p);
+    if(p->killed)
+      exit(-1);
+  }
+
+  // give up the CPU if the timer says so.
+  if(which_dev == 2 && proctick())
     yield();
 
   usertrapret();
@@ -125,7 +181,7 @@ usertrapret(void)
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -150,7 +206,7 @@ kerneltrap()
   }
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  if(which_dev == 2 && proctick())
     yield();
 
   // the yield() may have caused some traps to occur,
@@ -162,10 +218,16 @@ kerneltrap()
 void
 clockintr()
 {
+  int b;
+
   acquire(&tickslock);
   ticks++;
   wakeup(&ticks);
+  b = (ticks % BOOSTTICKS) == 0;
   release(&tickslock);
+  polltick();
+  if(b)
+    boost();
 }
 
 // check if it's an external interrupt or software interrupt,
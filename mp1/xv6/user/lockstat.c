@@ -0,0 +1,44 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+// Print the most contended locks, by total time spent waiting.
+// Needs a kernel built with make LOCKSTAT=1.
+
+#define NSTAT 64
+
+struct lockstat st[NSTAT];
+
+int
+main(int argc, char **argv)
+{
+  struct lockstat t;
+  int i, j, n, top;
+
+  top = 10;
+  if(argc > 1)
+    top = atoi(argv[1]);
+
+  if((n = lockstat(st, NSTAT)) < 0){
+    fprintf(2, "lockstat: kernel not built with LOCKSTAT\n");
+    exit(1);
+  }
+
+  for(i = 1; i < n; i++){
+    t = st[i];
+    for(j = i; j > 0 && st[j-1].wait < t.wait; j--)
+      st[j] = st[j-1];
+    st[j] = t;
+  }
+
+  printf("name             type     acquire  contend     wait  maxhold\n");
+  for(i = 0; i < n && i < top; i++){
+    printf("%s", st[i].name);
+    for(j = strlen(st[i].name); j < 17; j++)
+      printf(" ");
+    printf("%s %l %l %l %l\n", st[i].sleep ? "sleep" : "spin ",
+           st[i].nacquire, st[i].ncontend, st[i].wait, st[i].maxhold);
+  }
+  exit(0);
+}
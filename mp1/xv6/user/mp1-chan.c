@@ -0,0 +1,88 @@
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/threads.h"
+
+#define NULL 0
+#define N 1000
+#define NJOBS 100
+
+// A three-stage pipeline over small channels: numbers go from the
+// producer through a squaring stage to the consumer. Then a pool of
+// threads runs closures that a thread submits faster than they run.
+struct thread_chan nums, squares;
+struct thread_pool pool;
+int results[NJOBS];
+
+void producer(void *arg)
+{
+    for (int i = 1; i <= N; i++)
+        thread_chan_send(&nums, &i);
+    thread_chan_close(&nums);
+}
+
+void squarer(void *arg)
+{
+    int i;
+
+    while (thread_chan_recv(&nums, &i) == 0) {
+        i *= i;
+        thread_chan_send(&squares, &i);
+    }
+    thread_chan_close(&squares);
+}
+
+void consumer(void *arg)
+{
+    int i, n = 0, sum = 0;
+
+    while (thread_chan_recv(&squares, &i) == 0) {
+        sum += i;
+        n++;
+    }
+    printf("%d squares, sum %d\n", n, sum);
+    thread_chan_destroy(&nums);
+    thread_chan_destroy(&squares);
+}
+
+void job(void *arg)
+{
+    int i = (int)(long)arg;
+
+    thread_yield();
+    results[i] = 2 * i;
+}
+
+void submitter(void *arg)
+{
+    int sum = 0;
+
+    for (int i = 0; i < NJOBS; i++)
+        thread_pool_submit(&pool, job, (void *)(long)i);
+    thread_pool_wait(&pool);
+    for (int i = 0; i < NJOBS; i++)
+        sum += results[i];
+    printf("%d jobs, sum %d\n", NJOBS, sum);
+    thread_pool_shutdown(&pool);
+}
+
+int main(int argc, char **argv)
+{
+    printf("mp1-chan\n");
+    if (argc > 1 && thread_set_workers(atoi(argv[1])) < 0) {
+        printf("thread_set_workers failed\n");
+        exit(1);
+    }
+    if (thread_chan_init(&nums, 4, sizeof(int)) < 0 ||
+        thread_chan_init(&squares, 4, sizeof(int)) < 0 ||
+        thread_pool_init(&pool, 3, 8) != 3) {
+        printf("init failed\n");
+        exit(1);
+    }
+    thread_add_runqueue(thread_create(producer, NULL));
+    thread_add_runqueue(thread_create(squarer, NULL));
+    thread_add_runqueue(thread_create(consumer, NULL));
+    thread_add_runqueue(thread_create(submitter, NULL));
+    thread_start_threading();
+    printf("\nexited\n");
+    exit(0);
+}
@@ -0,0 +1,56 @@
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/threads.h"
+
+#define NULL 0
+#define NTHREADS 4
+#define FRAME 128 // bytes of pattern per call
+#define SLACK 384 // stack left below the deepest call, at most
+
+// Each thread recurses until it has used all but SLACK bytes of a
+// THREAD_STACK_SIZE stack, then spins there until every thread has
+// arrived, which only preemption allows. An alarm taken that deep
+// must not spill into the next thread's stack: every frame's
+// pattern is checked on the way back up.
+volatile int arrived;
+int intact, done;
+
+int deep(int id, char *top, int depth)
+{
+    char buf[FRAME];
+    int ok = 1;
+
+    memset(buf, id * 16 + depth, sizeof(buf));
+    if (top - buf < THREAD_STACK_SIZE - SLACK - FRAME)
+        ok = deep(id, top, depth + 1);
+    else {
+        __sync_fetch_and_add(&arrived, 1);
+        while (arrived < NTHREADS)
+            ;
+    }
+    for (int i = 0; i < FRAME; i++)
+        if (buf[i] != (char)(id * 16 + depth))
+            ok = 0;
+    return ok;
+}
+
+void f(void *arg)
+{
+    char top;
+
+    if (deep((int)(long)arg, &top, 0))
+        __sync_fetch_and_add(&intact, 1);
+    if (__sync_add_and_fetch(&done, 1) == NTHREADS)
+        printf("%d of %d stacks intact\n", intact, NTHREADS);
+}
+
+int main(int argc, char **argv)
+{
+    printf("mp1-deep\n");
+    thread_set_quantum(1);
+    for (int i = 0; i < NTHREADS; i++)
+        thread_add_runqueue(thread_create(f, (void *)(long)i));
+    thread_start_threading();
+    printf("\nexited\n");
+    exit(0);
+}
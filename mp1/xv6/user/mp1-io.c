@@ -0,0 +1,100 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/poll.h"
+#include "user/user.h"
+#include "user/threads.h"
+
+#define NULL 0
+#define NBYTES 8192
+#define CHUNK 100
+
+// A writer fills a pipe faster than a reader drains it, so each in
+// turn waits for the pipe while a third thread keeps yielding. Then
+// the last thread waits alone for a line from a child process, with
+// nothing else to run.
+int p[2], q[2];
+volatile int done = 0;
+int spins = 0;
+
+void writer(void *arg)
+{
+    char buf[CHUNK];
+    int n = 0, r;
+
+    memset(buf, 'x', sizeof(buf));
+    while (n < NBYTES) {
+        r = thread_write(p[1], buf, NBYTES - n < CHUNK ? NBYTES - n : CHUNK);
+        if (r <= 0) {
+            printf("thread_write failed\n");
+            exit(1);
+        }
+        n += r;
+    }
+    close(p[1]);
+}
+
+void reader(void *arg)
+{
+    char buf[CHUNK / 3];
+    int n = 0, r;
+
+    while ((r = thread_read(p[0], buf, sizeof(buf))) > 0) {
+        n += r;
+        thread_yield();
+    }
+    printf("read %d bytes\n", n);
+    __sync_fetch_and_add(&done, 1);
+}
+
+void spinner(void *arg)
+{
+    while (done == 0) {
+        spins++;
+        thread_yield();
+    }
+    printf("spinner ran: %d\n", spins > 0);
+}
+
+void waiter(void *arg)
+{
+    char buf[16];
+    int r;
+
+    if ((r = thread_read(q[0], buf, sizeof(buf))) != 6 || memcmp(buf, "hello\n", 6) != 0) {
+        printf("waiter read failed\n");
+        exit(1);
+    }
+    printf("waiter got hello\n");
+}
+
+int main(int argc, char **argv)
+{
+    printf("mp1-io\n");
+    if (argc > 1 && thread_set_workers(atoi(argv[1])) < 0) {
+        printf("thread_set_workers failed\n");
+        exit(1);
+    }
+    if (pipe(p) < 0 || pipe(q) < 0) {
+        printf("pipe failed\n");
+        exit(1);
+    }
+    if (fork() == 0) {
+        close(p[0]);
+        close(p[1]);
+        close(q[0]);
+        sleep(5);
+        write(q[1], "hello\n", 6);
+        exit(0);
+    }
+    close(q[1]);
+    fcntl(p[0], F_SETFL, O_NONBLOCK);
+    fcntl(p[1], F_SETFL, O_NONBLOCK);
+    fcntl(q[0], F_SETFL, O_NONBLOCK);
+    thread_add_runqueue(thread_create(writer, NULL));
+    thread_add_runqueue(thread_create(reader, NULL));
+    thread_add_runqueue(thread_create(spinner, NULL));
+    thread_add_runqueue(thread_create(waiter, NULL));
+    thread_start_threading();
+    printf("\nexited\n");
+    exit(0);
+}
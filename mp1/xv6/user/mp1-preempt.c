@@ -0,0 +1,41 @@
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/threads.h"
+
+#define NULL 0
+
+// Neither thread ever yields; each spins until it has seen
+// the other one run, which only preemption allows.
+volatile int ran1 = 0;
+volatile int ran2 = 0;
+
+void f2(void *arg)
+{
+    ran2 = 1;
+    while (!ran1)
+        ;
+    printf("thread 2: saw thread 1\n");
+    thread_exit();
+}
+
+void f1(void *arg)
+{
+    ran1 = 1;
+    while (!ran2)
+        ;
+    printf("thread 1: saw thread 2\n");
+    thread_exit();
+}
+
+int main(int argc, char **argv)
+{
+    printf("mp1-preempt\n");
+    thread_set_quantum(1);
+    struct thread *t1 = thread_create(f1, NULL);
+    thread_add_runqueue(t1);
+    struct thread *t2 = thread_create(f2, NULL);
+    thread_add_runqueue(t2);
+    thread_start_threading();
+    printf("\nexited\n");
+    exit(0);
+}
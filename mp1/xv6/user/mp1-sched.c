@@ -0,0 +1,59 @@
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/threads.h"
+
+#define NULL 0
+#define NTHREADS 3
+#define NSTEPS 3
+
+// One worker, so the order threads run in is the policy's alone.
+// Each policy runs in its own child, since the last thread to exit
+// ends the process.
+// Under THREAD_SCHED_PRIO the lowest priority runs until it exits;
+// under THREAD_SCHED_EDF each step pushes a thread's deadline back
+// by its period, so the threads interleave by period.
+int prio[NTHREADS] = {2, 0, 1};
+int period[NTHREADS] = {3, 2, 5};
+struct thread *threads[NTHREADS];
+
+void f(void *arg)
+{
+    int id = (int)(long)arg;
+    for (int i = 0; i < NSTEPS; i++) {
+        printf("%c%d ", 'A' + id, i);
+        thread_set_deadline(threads[id], (i + 2) * period[id]);
+        thread_yield();
+    }
+}
+
+void run(int policy)
+{
+    if (thread_set_policy(policy) < 0) {
+        printf("thread_set_policy failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < NTHREADS; i++) {
+        threads[i] = thread_create(f, (void *)(long)i);
+        thread_set_priority(threads[i], prio[i]);
+        thread_set_deadline(threads[i], period[i]);
+        thread_add_runqueue(threads[i]);
+    }
+    thread_start_threading();
+}
+
+int main(int argc, char **argv)
+{
+    printf("mp1-sched\n");
+    int policies[] = {THREAD_SCHED_PRIO, THREAD_SCHED_EDF};
+    for (int i = 0; i < 2; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("fork failed\n");
+            exit(1);
+        }
+        if (pid == 0)
+            run(policies[i]);
+        wait(NULL);
+    }
+    exit(0);
+}
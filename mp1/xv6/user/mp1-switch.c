@@ -0,0 +1,56 @@
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/threads.h"
+
+#define NULL 0
+
+// thread_yield() switches straight to the next thread when that
+// thread has nothing else to do, and goes through dispatch() when
+// it has a task waiting, has not run yet, or is the yielding thread
+// itself. The order must come out the same either way.
+struct thread *t2;
+
+void task(void *arg)
+{
+    printf("task %d\n", (int)(long)arg);
+}
+
+void late(void *arg)
+{
+    for (int i = 0; i < 2; i++) {
+        printf("thread 3: %d\n", i);
+        thread_yield();
+    }
+}
+
+void f2(void *arg)
+{
+    for (int i = 0; i < 4; i++) {
+        printf("thread 2: %d\n", i);
+        thread_yield();
+    }
+}
+
+void f1(void *arg)
+{
+    for (int i = 0; i < 7; i++) {
+        printf("thread 1: %d\n", i);
+        if (i == 1)
+            thread_assign_task(t2, task, (void *)1);
+        if (i == 2)
+            thread_add_runqueue(thread_create(late, NULL));
+        thread_yield();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    printf("mp1-switch\n");
+    struct thread *t1 = thread_create(f1, NULL);
+    thread_add_runqueue(t1);
+    t2 = thread_create(f2, NULL);
+    thread_add_runqueue(t2);
+    thread_start_threading();
+    printf("\nexited\n");
+    exit(0);
+}
@@ -0,0 +1,79 @@
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/threads.h"
+
+#define NULL 0
+#define NPROD 4
+#define NCONS 4
+#define NITEMS 500
+#define NBUF 8
+
+// Producers and consumers share a bounded buffer guarded by a
+// mutex and two condition variables; a semaphore counts the
+// consumers that are done. Waiting threads are parked, so this
+// finishes even with every thread blocked but one.
+struct thread_mutex lock;
+struct thread_cond notfull, notempty;
+struct thread_sem done;
+int buf[NBUF];
+int head, tail, count;
+int sum;
+
+void producer(void *arg)
+{
+    for (int i = 1; i <= NITEMS; i++) {
+        thread_mutex_lock(&lock);
+        while (count == NBUF)
+            thread_cond_wait(&notfull, &lock);
+        buf[tail] = i;
+        tail = (tail + 1) % NBUF;
+        count++;
+        thread_cond_signal(&notempty);
+        thread_mutex_unlock(&lock);
+    }
+}
+
+void consumer(void *arg)
+{
+    for (int i = 0; i < NITEMS; i++) {
+        thread_mutex_lock(&lock);
+        while (count == 0)
+            thread_cond_wait(&notempty, &lock);
+        sum += buf[head];
+        head = (head + 1) % NBUF;
+        count--;
+        thread_cond_signal(&notfull);
+        thread_mutex_unlock(&lock);
+    }
+    thread_sem_post(&done);
+}
+
+void waiter(void *arg)
+{
+    for (int i = 0; i < NCONS; i++)
+        thread_sem_wait(&done);
+    printf("sum %d, expected %d\n", sum, NPROD * NITEMS * (NITEMS + 1) / 2);
+}
+
+int main(int argc, char **argv)
+{
+    int n = argc > 1 ? atoi(argv[1]) : 4;
+
+    printf("mp1-sync\n");
+    if (thread_set_workers(n) < 0) {
+        printf("thread_set_workers failed\n");
+        exit(1);
+    }
+    thread_mutex_init(&lock);
+    thread_cond_init(&notfull);
+    thread_cond_init(&notempty);
+    thread_sem_init(&done, 0);
+    thread_add_runqueue(thread_create(waiter, NULL));
+    for (int i = 0; i < NCONS; i++)
+        thread_add_runqueue(thread_create(consumer, NULL));
+    for (int i = 0; i < NPROD; i++)
+        thread_add_runqueue(thread_create(producer, NULL));
+    thread_start_threading();
+    printf("\nexited\n");
+    exit(0);
+}
@@ -0,0 +1,38 @@
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/threads.h"
+
+#define NULL 0
+#define NTHREADS 16
+#define NYIELDS 1000
+
+// Threads start on the first worker and spread out by stealing;
+// every yield must come back, whichever worker resumes it.
+volatile int yields = 0;
+volatile int finished = 0;
+
+void f(void *arg)
+{
+    for (int i = 0; i < NYIELDS; i++) {
+        __sync_fetch_and_add(&yields, 1);
+        thread_yield();
+    }
+    if (__sync_add_and_fetch(&finished, 1) == NTHREADS)
+        printf("%d threads, %d yields\n", NTHREADS, yields);
+}
+
+int main(int argc, char **argv)
+{
+    printf("mp1-workers\n");
+    if (thread_set_workers(4) < 0) {
+        printf("thread_set_workers failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < NTHREADS; i++) {
+        struct thread *t = thread_create(f, NULL);
+        thread_add_runqueue(t);
+    }
+    thread_start_threading();
+    printf("\nexited\n");
+    exit(0);
+}
@@ -0,0 +1,37 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Run under nice: the process still gets the CPU, and cputime()
+// counts the ticks it spends there, no more than have passed.
+int
+main(int argc, char *argv[])
+{
+  int start, t, pid, xstate;
+
+  start = uptime();
+  while((t = cputime(getpid())) < 10)
+    ;
+  if(t > uptime() - start + 1){
+    printf("nicetest: cputime %d, only %d ticks passed\n", t, uptime() - start);
+    exit(1);
+  }
+  printf("nicetest: cputime ok\n");
+
+  // A child starts from zero, and is gone once reaped.
+  if((pid = fork()) < 0){
+    printf("nicetest: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0)
+    exit(cputime(getpid()) <= 1 ? 0 : 1);
+  if(wait(&xstate) != pid || xstate != 0){
+    printf("nicetest: child cputime not reset\n");
+    exit(1);
+  }
+  if(cputime(pid) != -1){
+    printf("nicetest: reaped child has a cputime\n");
+    exit(1);
+  }
+  printf("nicetest: ok\n");
+  exit(0);
+}
@@ -22,5 +22,6 @@ typedef struct jmp_buf_data jmp_buf[1];
 
 int setjmp(jmp_buf jmp);
 void longjmp(jmp_buf jmp, int ret);
+int swapjmp(jmp_buf save, jmp_buf load);
 
 #endif /* _SETJMP_H_ */
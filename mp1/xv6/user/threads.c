@@ -1,122 +1,1407 @@
 #include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/poll.h"
 #include "user/setjmp.h"
 #include "user/threads.h"
 #include "user/user.h"
 #define NULL 0
-#define MAX_TASK 20
 
-static struct thread* current_thread = NULL;
+// Workers.
+//
+// Green threads run on nworkers kernel threads made with clone(),
+// all sharing the address space. Each worker has its own run queue,
+// which only it runs threads from. A worker whose queue is empty
+// steals a thread that is not running from another worker's queue.
+// With one worker (the default) no kernel thread is created and the
+// library behaves as it always has.
+//
+// A thread that yields is still on its stack until the next one is
+// running, so it cannot be stolen until then: schedule() leaves it
+// marked running and finish_switch(), which runs first thing on the
+// other side of every switch, clears the mark. Threads and tasks that
+// exit are freed there too, once nothing runs on their stacks.
+//
+// Each worker finds its state through the tp register, which the
+// compiler leaves alone.
+#define NWORKER 8
+#define WORKER_STACK_SIZE 4096
+
+struct worker {
+    struct thread *current; // running thread, not in the run queue
+    volatile int lock; // guards the run queue and current against thieves
+    volatile int nqueued; // threads in the run queue
+    struct thread *head, *tail; // round-robin run queue
+    struct thread **heap; // priority and EDF run queue
+    void *heapbuf; // pooled buffer heap lives in
+    int nheap, heapcap;
+    int seq; // arrival order in the heap
+    volatile int no_preempt; // preempt_off
+    volatile int yield_pending; // preempt_pending
+    struct thread *prev; // thread switched away from, still marked running
+    struct thread *parked; // thread switching away to wait in park()
+    int nswitch; // switches, to poll for I/O every IO_POLL_INTERVAL
+    struct thread *dead; // exited threads, freed by finish_switch()
+    struct task *dead_tasks;
+    jmp_buf idle_env; // worker_loop(), for a thread exiting with the queue empty
+};
+
+static struct worker workers[NWORKER];
+static int nworkers = 1;
+static int mn; // set once workers other than the first may run
+static volatile int nlive; // threads added to a run queue and not yet exited
+static volatile int idle_seq; // bumped when a thread becomes runnable
+static volatile int nidle; // workers that may be in futex_wait(&idle_seq)
+static volatile int io_sleeping; // a worker may be waiting in io_poll()
+static volatile int pool_lock;
 static int id = 1;
+
+static struct worker *self(void){
+    struct worker *w;
+
+    if(!mn)
+        return &workers[0];
+    asm volatile("mv %0, tp" : "=r" (w));
+    return w;
+}
+
+static void set_self(struct worker *w){
+    asm volatile("mv tp, %0" : : "r" (w));
+}
+
+// The running worker's state, under the names it had when there
+// was only one.
+#define current_thread (self()->current)
+#define preempt_off (self()->no_preempt)
+#define preempt_pending (self()->yield_pending)
+
+// Locks are only needed once there is more than one worker.
+static void spin_lock(volatile int *l){
+    if(!mn)
+        return;
+    while(__sync_lock_test_and_set(l, 1))
+        ;
+}
+
+static void spin_unlock(volatile int *l){
+    if(mn)
+        __sync_lock_release(l);
+}
 // static jmp_buf env_st;
 // static jmp_buf env_tmp;
 
+// Stack and thread pools.
+//
+// Stacks come in power-of-two size classes carved out of an arena
+// that is grown with sbrk() apart from malloc()'s free list. A freed
+// stack goes on the free list of its class and the next thread or
+// task of that size takes it back, so creating one is a few pointer
+// operations. struct thread and struct task are recycled the same way.
+//
+// xv6 cannot unmap a guard page from user space, so the lowest word
+// of a stack in use holds a canary (with the size class in its low
+// byte) that is checked when the stack is freed.
+#define STACK_MIN 1024 // smallest stack class, in bytes
+#define NSTACKCLASS 8 // up to STACK_MIN << 7 = 128 KiB
+#define BUF_HDR 16 // other buffers from the pool start past the canary
+#define STACK_CANARY 0x57ac4ca4a5adf00dUL
+#define ARENA_CHUNK (4096*4) // sbrk() at least this much at a time
+
+struct pool_block {
+    struct pool_block *next;
+};
+
+static struct pool_block *stack_pool[NSTACKCLASS];
+static struct pool_block *thread_pool;
+static struct pool_block *task_pool;
+static char *arena, *arena_end;
+static int stack_class = -1; // class of new stacks, -1 until set
+static int stack_size = THREAD_STACK_SIZE; // bytes new stacks must offer
+
+// Carve n bytes from the arena, growing it if needed.
+// Caller must hold pool_lock.
+static void *arena_alloc(int n){
+    char *p;
+    int grow;
+
+    n = (n + 15) & ~15;
+    if(arena_end - arena < n){
+        grow = n > ARENA_CHUNK ? n : ARENA_CHUNK;
+        p = sbrk(grow);
+        if(p == (char*)-1)
+            return NULL;
+        if(p != arena_end) // malloc() took the memory in between
+            arena = p;
+        arena_end = p + grow;
+    }
+    p = arena;
+    arena += n;
+    return p;
+}
+
+// Smallest stack class of at least size bytes, or -1.
+static int size_class(int size){
+    int c;
+
+    for(c = 0; c < NSTACKCLASS; c++)
+        if((STACK_MIN << c) >= size)
+            return c;
+    return -1;
+}
+
+// Return the base of a free stack of class c.
+static void *stack_alloc_class(int c){
+    struct pool_block *b;
+
+    spin_lock(&pool_lock);
+    if((b = stack_pool[c]) != NULL)
+        stack_pool[c] = b->next;
+    else
+        b = arena_alloc(STACK_MIN << c);
+    spin_unlock(&pool_lock);
+    if(b == NULL)
+        return NULL;
+    *(unsigned long*)b = STACK_CANARY ^ c;
+    return b;
+}
+
+// Return the base of a free stack of the current class.
+static void *stack_alloc(void){
+    if(stack_class < 0)
+        stack_class = size_class(THREAD_STACK_SIZE);
+    return stack_alloc_class(stack_class);
+}
+
+// Initial stack pointer for the stack at base.
+static void *stack_top(void *base){
+    int c = *(unsigned long*)base ^ STACK_CANARY;
+    return (char*)base + (STACK_MIN << c) - 0x2*8;
+}
+
+static void stack_free(void *base){
+    unsigned long c = *(unsigned long*)base ^ STACK_CANARY;
+    struct pool_block *b = base;
+
+    if(c >= NSTACKCLASS){
+        fprintf(2, "threads: stack overflow\n");
+        exit(1);
+    }
+    spin_lock(&pool_lock);
+    b->next = stack_pool[c];
+    stack_pool[c] = b;
+    spin_unlock(&pool_lock);
+}
+
+static struct thread *thread_alloc(void){
+    struct pool_block *b;
+
+    spin_lock(&pool_lock);
+    if((b = thread_pool) != NULL)
+        thread_pool = b->next;
+    else
+        b = arena_alloc(sizeof(struct thread));
+    spin_unlock(&pool_lock);
+    return (struct thread*) b;
+}
+
+static void thread_free(struct thread *t){
+    struct pool_block *b = (struct pool_block*) t;
+
+    spin_lock(&pool_lock);
+    b->next = thread_pool;
+    thread_pool = b;
+    spin_unlock(&pool_lock);
+}
+
+static struct task *task_alloc(void){
+    struct pool_block *b;
+
+    spin_lock(&pool_lock);
+    if((b = task_pool) != NULL)
+        task_pool = b->next;
+    else
+        b = arena_alloc(sizeof(struct task));
+    spin_unlock(&pool_lock);
+    return (struct task*) b;
+}
+
+// Free task k and its stack or saved frames.
+static void task_free(struct task *k){
+    struct pool_block *b = (struct pool_block*) k;
+
+    if(k->stack != NULL)
+        stack_free(k->stack);
+    if(k->saved != NULL)
+        stack_free(k->saved);
+    spin_lock(&pool_lock);
+    b->next = task_pool;
+    task_pool = b;
+    spin_unlock(&pool_lock);
+}
+
+// Free all of t's pending tasks.
+static void thread_free_tasks(struct thread *t){
+    struct task *k;
+
+    while((k = t->tasks) != NULL){
+        t->tasks = k->next;
+        task_free(k);
+    }
+}
+
+// Lazy task stacks.
+//
+// Most tasks run to completion, or yield once, so giving each its
+// own stack up front is wasted work. In lazy mode, which a program
+// turns on with thread_set_lazy_tasks(), a task gets no stack when
+// it is assigned; it starts on the shared run stack. If it yields,
+// task_save() copies its live frames, from its saved sp to the top
+// of the run stack, into a pooled buffer that is just as large, and
+// resuming copies them back to the same addresses. Frames hold pointers into themselves (the frame pointer
+// chain, addresses of locals), so they cannot be moved to a stack of
+// their own.
+//
+// The copy back is done from a small switch stack, since dispatch()
+// itself may be running on the run stack.
+//
+// Frames can only go back on the run stack they were saved from, and
+// a thread may move to another worker, so with more than one worker
+// every task gets a stack of its own.
+//
+// While a lazy task is suspended its frames are not at their
+// addresses, so a pointer to one of its locals held by another
+// thread reads, or writes, whatever the run stack now holds there.
+// Hence it is off by default.
+#ifndef TASK_RUN_STACK_SIZE
+#define TASK_RUN_STACK_SIZE (16*1024)
+#endif
+#define SAVE_HDR 16 // canary, then the frames
+
+static int lazy_tasks;
+static char *run_stack_top; // initial sp of the shared run stack
+static void *switch_stack_top;
+static jmp_buf switch_env;
+static struct task *restoring; // task restore_entry() is to resume
+
+static int run_stack_init(void){
+    void *s, *w;
+
+    if(run_stack_top != NULL)
+        return 0;
+    if((s = stack_alloc_class(size_class(TASK_RUN_STACK_SIZE))) == NULL)
+        return -1;
+    if((w = stack_alloc_class(0)) == NULL){
+        stack_free(s);
+        return -1;
+    }
+    run_stack_top = stack_top(s);
+    switch_stack_top = stack_top(w);
+    return 0;
+}
+
+// Copy the frames of lazy task k, which is about to yield,
+// off the run stack.
+static void task_save(struct task *k){
+    int n = run_stack_top - (char*) k->env->sp;
+    int c = size_class(n + SAVE_HDR);
+    char *buf;
+
+    if(c < 0 || (buf = stack_alloc_class(c)) == NULL){
+        fprintf(2, "threads: cannot save task stack\n");
+        exit(1);
+    }
+    memmove(buf + SAVE_HDR, (char*) k->env->sp, n);
+    k->saved = buf;
+    k->saved_len = n;
+}
+
+// Runs on the switch stack: put the frames of restoring back
+// on the run stack and resume it.
+static void restore_entry(void){
+    struct task *k = restoring;
+
+    memmove((char*) k->env->sp, (char*) k->saved + SAVE_HDR, k->saved_len);
+    stack_free(k->saved);
+    k->saved = NULL;
+    longjmp(k->env, 1);
+}
+
+// Run tasks assigned from now on on the shared run stack if on is
+// non-zero, or each on its own stack. Returns the previous mode.
+int thread_set_lazy_tasks(int on){
+    int old = lazy_tasks;
+
+    lazy_tasks = on;
+    return old;
+}
+
+// Preemption.
+//
+// With a quantum set, thread_start_threading() asks the kernel for
+// an alarm every quantum timer ticks. The alarm handler runs on the
+// interrupted thread's stack, on top of the registers the kernel
+// saved there, and yields on its behalf as if it had called
+// thread_yield(). When that thread is dispatched again the handler
+// carries on and sigreturn()s to where it was interrupted.
+//
+// A thread can be preempted at its deepest, so while a quantum is
+// set new stacks get PREEMPT_STACK_RESERVE bytes more than asked
+// for: room for the saved registers (a 288-byte struct trapframe),
+// the handler, and the switch it makes.
+//
+// The library's own code runs with preempt_off set. An alarm that
+// lands there only sets preempt_pending, and the yield is taken on
+// the way out.
+static int quantum; // timer ticks per time slice, 0: cooperative
+#ifndef PREEMPT_STACK_RESERVE
+#define PREEMPT_STACK_RESERVE 1024
+#endif
+
+static void yield_current(void);
+static int io_poll(int wait, int seq);
+static void io_queue(struct thread *t);
+static void io_kick(void);
+
+static void preempt_enable(void){
+    preempt_off = 0;
+    if(preempt_pending){
+        preempt_pending = 0;
+        thread_yield();
+    }
+}
+
+// Word of the saved registers (a struct trapframe) holding tp.
+#define FRAME_TP 8
+
+static void alarm_handler(void *frame){
+    if(preempt_off || current_thread == NULL){
+        preempt_pending = 1;
+        sigreturn(frame);
+    }
+    preempt_off = 1;
+    sigalarm(quantum, alarm_handler); // let the next alarm in
+    yield_current();
+    preempt_off = 0;
+    // The thread may have been stolen by another worker meanwhile;
+    // return to it with that worker's tp, not the one it left.
+    if(mn)
+        ((uint64 *)frame)[FRAME_TP] = (uint64)self();
+    sigreturn(frame);
+}
+
+// Class of stacks offering size bytes, plus the reserve for
+// alarms if preemption is on; -1 if there is none that large.
+static int stack_class_for(int size){
+    return size_class(quantum > 0 ? size + PREEMPT_STACK_RESERVE : size);
+}
+
+// Preempt the running thread every ticks timer ticks, or never
+// if ticks is 0 (the default). Threads and tasks created before
+// a quantum is set have no room reserved for the alarm.
+void thread_set_quantum(int ticks){
+    int c;
+
+    quantum = ticks;
+    if((c = stack_class_for(stack_size)) >= 0)
+        stack_class = c;
+    if(current_thread != NULL)
+        sigalarm(ticks, ticks > 0 ? alarm_handler : 0);
+}
+
+// Use stacks of at least size bytes for threads and tasks
+// created from now on. Returns -1 if size is too large.
+int thread_set_stack_size(int size){
+    int c = stack_class_for(size);
+
+    if(c < 0)
+        return -1;
+    stack_size = size;
+    stack_class = c;
+    return 0;
+}
+
 struct thread *thread_create(void (*f)(void *), void *arg){
-    struct thread *t = (struct thread*) malloc(sizeof(struct thread));
-    unsigned long new_stack_p;
-    unsigned long new_stack;
-    new_stack = (unsigned long) malloc(sizeof(unsigned long)*0x100);
-    new_stack_p = new_stack +0x100*8-0x2*8;
+    struct thread *t;
+    void *new_stack;
+
+    preempt_off = 1;
+    t = thread_alloc();
+    if(t != NULL && (new_stack = stack_alloc()) == NULL){
+        thread_free(t);
+        t = NULL;
+    }
+    if(t == NULL){
+        preempt_enable();
+        return NULL;
+    }
     t->fp = f;
     t->arg = arg;
-    t->ID  = id; //id starts from 1 and increment
+    t->ID  = __sync_fetch_and_add(&id, 1); //id starts from 1 and increment
     t->buf_set = -1; //indicate jmp_buf (env) not set
-    t->num_tasks = -1;
-    t->current_task = -1;
+    t->tasks = NULL;
+    t->current_task = NULL;
     t->thread_yield = 0;
     t->task_yield =0;
-    t->stack = (void*) new_stack;
-    t->stack_p = (void*) new_stack_p;
+    t->stack = new_stack;
+    t->stack_p = stack_top(new_stack);
     t->next = NULL;
     t->previous = NULL;
-    id++;
+    t->running = 0;
+    t->lock = 0;
+    t->priority = 0;
+    t->deadline = THREAD_NO_DEADLINE;
     //printf("Thread created.\n");
+    preempt_enable();
     return t;
 }
+// Scheduling policies.
+//
+// A worker's runnable threads, apart from the running one, wait in
+// its run queue, and the policy decides the order they run in.
+// Round robin (the default) keeps a FIFO list, so threads take turns
+// in the order they were added. The fixed-priority and EDF policies
+// keep a binary heap ordered by priority or deadline, lowest first,
+// and by arrival among equals, so equals still take turns. A thread
+// that yields goes back in the queue before the next one is picked,
+// and keeps running if nothing comes before it. All workers use the
+// same policy. The run queue functions are called with w->lock held.
+
+struct policy {
+    void (*push)(struct worker *w, struct thread *t);
+    struct thread *(*pop)(struct worker *w); // next to run, or NULL
+    struct thread *(*take)(struct worker *w); // one not running, for a thief
+};
+
+static int sched_policy = THREAD_SCHED_RR;
+
+static void rr_unlink(struct worker *w, struct thread *t){
+    if(t->previous != NULL)
+        t->previous->next = t->next;
+    else
+        w->head = t->next;
+    if(t->next != NULL)
+        t->next->previous = t->previous;
+    else
+        w->tail = t->previous;
+}
+
+static void rr_push(struct worker *w, struct thread *t){
+    // TODO add the element as and remember to link prev and next
+    t->next = NULL;
+    t->previous = w->tail;
+    if(w->tail != NULL)
+        w->tail->next = t;
+    else
+        w->head = t;
+    w->tail = t;
+}
+
+static struct thread *rr_pop(struct worker *w){
+    struct thread *t = w->head;
+
+    if(t != NULL)
+        rr_unlink(w, t);
+    return t;
+}
+
+static struct thread *rr_take(struct worker *w){
+    struct thread *t;
+
+    for(t = w->head; t != NULL && t->running; t = t->next)
+        ;
+    if(t != NULL)
+        rr_unlink(w, t);
+    return t;
+}
+
+// Whether a runs before b.
+static int heap_before(struct thread *a, struct thread *b){
+    int ka = a->priority, kb = b->priority;
+
+    if(sched_policy == THREAD_SCHED_EDF){
+        ka = a->deadline;
+        kb = b->deadline;
+    }
+    if(ka != kb)
+        return ka < kb;
+    return a->seq - b->seq < 0;
+}
+
+static void heap_swap(struct worker *w, int i, int j){
+    struct thread *t = w->heap[i];
+
+    w->heap[i] = w->heap[j];
+    w->heap[j] = t;
+}
+
+static void heap_up(struct worker *w, int i){
+    while(i > 0 && heap_before(w->heap[i], w->heap[(i - 1) / 2])){
+        heap_swap(w, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(struct worker *w, int i){
+    int c;
+
+    while((c = 2 * i + 1) < w->nheap){
+        if(c + 1 < w->nheap && heap_before(w->heap[c + 1], w->heap[c]))
+            c++;
+        if(!heap_before(w->heap[c], w->heap[i]))
+            break;
+        heap_swap(w, i, c);
+        i = c;
+    }
+}
+
+static void heap_remove(struct worker *w, int i){
+    if(i < --w->nheap){
+        w->heap[i] = w->heap[w->nheap];
+        heap_up(w, i);
+        heap_down(w, i);
+    }
+}
+
+// Double the heap's room, in a buffer from the stack pool.
+static int heap_grow(struct worker *w){
+    int c = size_class(BUF_HDR + 2 * (w->heapcap + 8) * sizeof(struct thread*));
+    char *b;
+
+    if(c < 0 || (b = stack_alloc_class(c)) == NULL)
+        return -1;
+    memmove(b + BUF_HDR, w->heap, w->nheap * sizeof(struct thread*));
+    if(w->heapbuf != NULL)
+        stack_free(w->heapbuf);
+    w->heapbuf = b;
+    w->heap = (struct thread**) (b + BUF_HDR);
+    w->heapcap = ((STACK_MIN << c) - BUF_HDR) / sizeof(struct thread*);
+    return 0;
+}
+
+static void heap_push(struct worker *w, struct thread *t){
+    if(w->nheap == w->heapcap && heap_grow(w) < 0){
+        fprintf(2, "threads: out of memory for run queue\n");
+        exit(1);
+    }
+    t->seq = w->seq++;
+    w->heap[w->nheap] = t;
+    heap_up(w, w->nheap++);
+}
+
+static struct thread *heap_pop(struct worker *w){
+    struct thread *t;
+
+    if(w->nheap == 0)
+        return NULL;
+    t = w->heap[0];
+    heap_remove(w, 0);
+    return t;
+}
+
+static struct thread *heap_take(struct worker *w){
+    struct thread *t;
+    int i;
+
+    for(i = 0; i < w->nheap; i++){
+        if(!w->heap[i]->running){
+            t = w->heap[i];
+            heap_remove(w, i);
+            return t;
+        }
+    }
+    return NULL;
+}
+
+static const struct policy policies[] = {
+    [THREAD_SCHED_RR] = { rr_push, rr_pop, rr_take },
+    [THREAD_SCHED_PRIO] = { heap_push, heap_pop, heap_take },
+    [THREAD_SCHED_EDF] = { heap_push, heap_pop, heap_take },
+};
+
+static void rq_push(struct worker *w, struct thread *t){
+    policies[sched_policy].push(w, t);
+    w->nqueued++;
+}
+
+// Make the next thread in w's run queue current, if there is one.
+static void run_next(struct worker *w){
+    struct thread *t = policies[sched_policy].pop(w);
+
+    if(t != NULL){
+        w->nqueued--;
+        t->running = 1;
+    }
+    w->current = t;
+}
+
+static struct thread *rq_take(struct worker *w){
+    struct thread *t = policies[sched_policy].take(w);
+
+    if(t != NULL)
+        w->nqueued--;
+    return t;
+}
+
+// Choose how threads are ordered. Only before any thread has been
+// added to the run queue. Returns -1 if that is too late or policy
+// is unknown.
+int thread_set_policy(int policy){
+    if(policy < THREAD_SCHED_RR || policy > THREAD_SCHED_EDF || nlive > 0)
+        return -1;
+    sched_policy = policy;
+    return 0;
+}
+
+// Set t's priority (lower runs first) or deadline (earlier runs
+// first). The new value counts from the next time t is queued, so
+// a running thread may set its own before it yields.
+void thread_set_priority(struct thread *t, int priority){
+    t->priority = priority;
+}
+
+void thread_set_deadline(struct thread *t, int deadline){
+    t->deadline = deadline;
+}
+
+// Queue t on the running worker, and wake an idle worker to
+// steal it.
+static void make_runnable(struct thread *t){
+    struct worker *w = self();
+
+    spin_lock(&w->lock);
+    rq_push(w, t);
+    spin_unlock(&w->lock);
+    __sync_fetch_and_add(&idle_seq, 1);
+    if(nidle > 0)
+        futex_wake(&idle_seq, 1);
+    if(io_sleeping)
+        io_kick();
+}
+
 void thread_add_runqueue(struct thread *t){
+    preempt_off = 1;
+    __sync_fetch_and_add(&nlive, 1);
+    make_runnable(t);
+    //printf("done thread_add_runqueue\n");
+    preempt_enable();
+}
+// Run entry() on a fresh stack whose initial stack pointer is sp,
+// using env. Jumping to a new frame, instead of moving the stack
+// pointer under dispatch(), keeps dispatch()'s locals from being
+// stored above sp, into whatever lies past the top of the stack.
+static void start_on(jmp_buf env, void *sp, void (*entry)(void)){
+    memset(env, 0, sizeof(jmp_buf));
+    env->ra = (unsigned long) entry;
+    env->sp = (unsigned long) sp;
+    longjmp(env, 1);
+}
+
+// Blocking.
+//
+// A thread that waits on a word in park() stays off its worker's
+// run queue, on a wait queue hashed by the word's address, and
+// unpark() puts it on the run queue of the worker that wakes it.
+// This is the futex protocol one level up: the word is compared
+// with the expected value under the queue's lock, so a wakeup
+// that follows a change to the word is never missed. The thread
+// is only queued once its worker has switched off its stack, so
+// that whoever wakes it cannot run it while it is still in use.
+//
+// Idle workers wait in the kernel, in futex_wait() on idle_seq.
+#define NPARKQ 31
+#define PARKQ(addr) (&parkq[((unsigned long) (addr) >> 2) % NPARKQ])
+
+static struct parkq {
+    volatile int lock;
+    struct thread *head; // first to wait, linked through next
+    struct thread *tail;
+} parkq[NPARKQ];
+
+static volatile int nkwait; // callers in futex_wait() for lack of a thread
+
+// Wait on addr while it holds val. Called with preempt_off set.
+static void park(volatile int *addr, int val){
+    struct thread *t = current_thread;
+
+    t->wchan = addr;
+    t->wval = val;
+    self()->parked = t;
+    yield_current();
+}
+
+// Called by finish_switch() for a thread that has parked.
+static void park_queue(struct thread *t){
+    struct parkq *q;
+
+    if(t->wchan == NULL){ // in thread_wait_io()
+        io_queue(t);
+        return;
+    }
+    q = PARKQ(t->wchan);
+    spin_lock(&q->lock);
+    if(*t->wchan == t->wval){
+        t->next = NULL;
+        if(q->tail != NULL)
+            q->tail->next = t;
+        else
+            q->head = t;
+        q->tail = t;
+        t = NULL;
+    }
+    spin_unlock(&q->lock);
+    if(t != NULL) // the word changed before it was queued
+        make_runnable(t);
+}
+
+// Wake up to n threads parked on addr. Returns the number woken.
+static int unpark(volatile int *addr, int n){
+    struct parkq *q = PARKQ(addr);
+    struct thread *t, **tp, *woken = NULL;
+    int i = 0;
+
+    spin_lock(&q->lock);
+    q->tail = NULL;
+    for(tp = &q->head; (t = *tp) != NULL; ){
+        if(t->wchan == addr && i < n){
+            *tp = t->next;
+            t->wchan = NULL;
+            t->previous = woken;
+            woken = t;
+            i++;
+        }else{
+            q->tail = t;
+            tp = &t->next;
+        }
+    }
+    spin_unlock(&q->lock);
+    while((t = woken) != NULL){
+        woken = t->previous;
+        make_runnable(t);
+    }
+    return i;
+}
+
+// Block the calling thread while *addr is val, as futex_wait()
+// does for a process. Returns 0 once woken, -1 if *addr was not
+// val. Outside of threads the caller waits in futex_wait().
+int thread_futex_wait(volatile int *addr, int val){
+    int r;
+
     if(current_thread == NULL){
-        // TODO add the element as the first
-        current_thread = t;
-        current_thread->previous = current_thread;
-        current_thread->next = current_thread;
-    }
-    else{
-        // TODO add the element as and remember to link prev and next
-        t->previous = current_thread->previous;
-        t->next = current_thread;
-        current_thread->previous->next = t;
-        current_thread->previous = t;
+        __sync_fetch_and_add(&nkwait, 1);
+        r = futex_wait(addr, val);
+        __sync_fetch_and_sub(&nkwait, 1);
+        return r;
     }
-    //printf("done thread_add_runqueue\n");
+    preempt_off = 1;
+    if(*addr != val){
+        preempt_enable();
+        return -1;
+    }
+    park(addr, val);
+    preempt_enable();
+    return 0;
+}
+
+// Wake up to n threads waiting on addr. Returns the number woken.
+int thread_futex_wake(volatile int *addr, int n){
+    int woken;
+
+    preempt_off = 1;
+    woken = unpark(addr, n);
+    preempt_enable();
+    if(woken < n && nkwait > 0)
+        woken += futex_wake(addr, n - woken);
+    return woken;
+}
+
+// A mutex is 0 when free, 1 when held, and 2 when held with
+// threads that may be waiting for it, so that unlocking an
+// uncontended mutex wakes no one.
+void thread_mutex_init(struct thread_mutex *m){
+    m->state = 0;
+}
+
+void thread_mutex_lock(struct thread_mutex *m){
+    int c;
+
+    if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+        return;
+    if(c != 2)
+        c = __sync_lock_test_and_set(&m->state, 2);
+    while(c != 0){
+        thread_futex_wait(&m->state, 2);
+        c = __sync_lock_test_and_set(&m->state, 2);
+    }
+}
+
+void thread_mutex_unlock(struct thread_mutex *m){
+    if(__sync_fetch_and_sub(&m->state, 1) != 1){
+        m->state = 0;
+        thread_futex_wake(&m->state, 1);
+    }
+}
+
+void thread_cond_init(struct thread_cond *c){
+    c->seq = 0;
+}
+
+// Release m and wait for a signal, then take m again. Wakeups
+// may be spurious, so check the condition in a loop.
+void thread_cond_wait(struct thread_cond *c, struct thread_mutex *m){
+    int seq = c->seq;
+
+    thread_mutex_unlock(m);
+    thread_futex_wait(&c->seq, seq);
+    thread_mutex_lock(m);
+}
+
+void thread_cond_signal(struct thread_cond *c){
+    __sync_fetch_and_add(&c->seq, 1);
+    thread_futex_wake(&c->seq, 1);
+}
+
+void thread_cond_broadcast(struct thread_cond *c){
+    __sync_fetch_and_add(&c->seq, 1);
+    thread_futex_wake(&c->seq, 0x7fffffff);
+}
+
+void thread_sem_init(struct thread_sem *s, int count){
+    s->count = count;
+    s->waiters = 0;
+}
+
+void thread_sem_wait(struct thread_sem *s){
+    int c;
+
+    for(;;){
+        c = s->count;
+        if(c > 0){
+            if(__sync_bool_compare_and_swap(&s->count, c, c - 1))
+                return;
+            continue;
+        }
+        __sync_fetch_and_add(&s->waiters, 1);
+        thread_futex_wait(&s->count, 0);
+        __sync_fetch_and_sub(&s->waiters, 1);
+    }
+}
+
+void thread_sem_post(struct thread_sem *s){
+    __sync_fetch_and_add(&s->count, 1);
+    if(s->waiters > 0)
+        thread_futex_wake(&s->count, 1);
+}
+
+// Channels.
+//
+// A channel is a ring of cap messages of size bytes each, in a
+// buffer from the stack pool, so a message is copied in by
+// thread_chan_send() and out by thread_chan_recv() with nothing
+// allocated. Senders wait while the ring is full and receivers
+// while it is empty, on condition variables under the channel's
+// mutex, and each side is only signalled if some of it waits.
+int thread_chan_init(struct thread_chan *c, int cap, int size){
+    int cls = size_class(BUF_HDR + cap * size);
+
+    if(cap < 1 || size < 1 || cls < 0)
+        return -1;
+    preempt_off = 1;
+    c->mem = stack_alloc_class(cls);
+    preempt_enable();
+    if(c->mem == NULL)
+        return -1;
+    c->buf = (char *) c->mem + BUF_HDR;
+    c->cap = cap;
+    c->size = size;
+    c->head = 0;
+    c->count = 0;
+    c->closed = 0;
+    c->nsend = 0;
+    c->nrecv = 0;
+    thread_mutex_init(&c->lock);
+    thread_cond_init(&c->notfull);
+    thread_cond_init(&c->notempty);
+    return 0;
+}
+
+// Copy the message at msg into c, waiting while c is full.
+// Returns -1 if c is closed.
+int thread_chan_send(struct thread_chan *c, const void *msg){
+    thread_mutex_lock(&c->lock);
+    while(c->count == c->cap && !c->closed){
+        c->nsend++;
+        thread_cond_wait(&c->notfull, &c->lock);
+        c->nsend--;
+    }
+    if(c->closed){
+        thread_mutex_unlock(&c->lock);
+        return -1;
+    }
+    memmove(c->buf + (c->head + c->count) % c->cap * c->size, msg, c->size);
+    c->count++;
+    if(c->nrecv > 0)
+        thread_cond_signal(&c->notempty);
+    thread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+// Copy the oldest message in c to msg, waiting while c is empty.
+// Returns -1 once c is closed and empty.
+int thread_chan_recv(struct thread_chan *c, void *msg){
+    thread_mutex_lock(&c->lock);
+    while(c->count == 0 && !c->closed){
+        c->nrecv++;
+        thread_cond_wait(&c->notempty, &c->lock);
+        c->nrecv--;
+    }
+    if(c->count == 0){
+        thread_mutex_unlock(&c->lock);
+        return -1;
+    }
+    memmove(msg, c->buf + c->head * c->size, c->size);
+    c->head = (c->head + 1) % c->cap;
+    c->count--;
+    if(c->nsend > 0)
+        thread_cond_signal(&c->notfull);
+    thread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+// Refuse further sends. Receivers still get what c holds.
+void thread_chan_close(struct thread_chan *c){
+    thread_mutex_lock(&c->lock);
+    c->closed = 1;
+    thread_cond_broadcast(&c->notfull);
+    thread_cond_broadcast(&c->notempty);
+    thread_mutex_unlock(&c->lock);
+}
+
+// Free c's buffer, once no thread uses c.
+void thread_chan_destroy(struct thread_chan *c){
+    preempt_off = 1;
+    stack_free(c->mem);
+    preempt_enable();
+    c->mem = NULL;
+}
+
+// Thread pools.
+//
+// A pool runs closures submitted to it on a fixed set of threads,
+// which take them in turn from a channel, so a closure goes to
+// whichever thread is free first. The last thread to leave a pool
+// that has been shut down frees the channel.
+struct pool_job {
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+static void pool_thread(void *arg){
+    struct thread_pool *p = arg;
+    struct pool_job j;
+
+    while(thread_chan_recv(&p->jobs, &j) == 0){
+        j.fn(j.arg);
+        if(__sync_sub_and_fetch(&p->pending, 1) == 0){
+            thread_mutex_lock(&p->lock);
+            thread_cond_broadcast(&p->done);
+            thread_mutex_unlock(&p->lock);
+        }
+    }
+    if(__sync_sub_and_fetch(&p->nthreads, 1) == 0)
+        thread_chan_destroy(&p->jobs);
+}
+
+// Start nthreads threads that run closures submitted to p, queueing
+// up to queue of them. Returns the number of threads started, or -1
+// if there are none.
+int thread_pool_init(struct thread_pool *p, int nthreads, int queue){
+    struct thread *t;
+    int i;
+
+    if(nthreads < 1 || thread_chan_init(&p->jobs, queue, sizeof(struct pool_job)) < 0)
+        return -1;
+    p->pending = 0;
+    p->nthreads = nthreads;
+    thread_mutex_init(&p->lock);
+    thread_cond_init(&p->done);
+    for(i = 0; i < nthreads; i++){
+        if((t = thread_create(pool_thread, p)) == NULL)
+            break;
+        thread_add_runqueue(t);
+    }
+    if(i == 0){
+        thread_chan_destroy(&p->jobs);
+        return -1;
+    }
+    __sync_fetch_and_sub(&p->nthreads, nthreads - i);
+    return i;
+}
+
+// Queue fn(arg) to run on p, waiting while the queue is full.
+// Returns -1 if p has been shut down.
+int thread_pool_submit(struct thread_pool *p, void (*fn)(void *), void *arg){
+    struct pool_job j;
+
+    j.fn = fn;
+    j.arg = arg;
+    __sync_fetch_and_add(&p->pending, 1);
+    if(thread_chan_send(&p->jobs, &j) < 0){
+        __sync_fetch_and_sub(&p->pending, 1);
+        return -1;
+    }
+    return 0;
+}
+
+// Wait until every closure submitted to p has returned.
+void thread_pool_wait(struct thread_pool *p){
+    thread_mutex_lock(&p->lock);
+    while(p->pending > 0)
+        thread_cond_wait(&p->done, &p->lock);
+    thread_mutex_unlock(&p->lock);
+}
+
+// Let p's threads exit once the closures queued have run.
+void thread_pool_shutdown(struct thread_pool *p){
+    thread_chan_close(&p->jobs);
+}
+
+// I/O.
+//
+// A thread in thread_wait_io() parks on ioq with the descriptor and
+// events it waits for, and workers find out which are ready with
+// poll(). A worker with nothing to run waits in poll() on them and on
+// a wakeup pipe, which make_runnable() and io_queue() write to while
+// it is there. A busy worker polls without waiting every
+// IO_POLL_INTERVAL switches. One worker polls at a time. The
+// workers share one descriptor table, so threads may open and close
+// descriptors on any of them.
+#define IO_POLL_INTERVAL 16
+#define NIOPOLL 15 // descriptors polled at once, with the wakeup pipe
+
+static volatile int io_lock;
+static struct thread *ioq_head, *ioq_tail; // linked through next
+static volatile int io_polling; // a worker is in io_poll()
+static int io_wake[2] = {-1, -1}; // wakeup pipe, both ends O_NONBLOCK
+
+static void io_wake_init(void){
+    int fds[2];
+
+    if(io_wake[0] >= 0 || pipe(fds) < 0)
+        return;
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    io_wake[0] = fds[0];
+    io_wake[1] = fds[1];
+}
+
+static void io_kick(void){
+    char c = 0;
+
+    write(io_wake[1], &c, 1);
+}
+
+// Called by park_queue() for a thread that has parked on I/O.
+static void io_queue(struct thread *t){
+    spin_lock(&io_lock);
+    t->next = NULL;
+    if(ioq_tail != NULL)
+        ioq_tail->next = t;
+    else
+        ioq_head = t;
+    ioq_tail = t;
+    spin_unlock(&io_lock);
+    __sync_synchronize();
+    if(io_sleeping) // the poll() under way does not have t's fd
+        io_kick();
+}
+
+// Poll the descriptors threads wait on and make runnable those
+// whose descriptor is ready. If wait is set, wait in poll() until
+// one is, unless a thread has been made runnable since idle_seq was
+// seq. Returns -1 if nothing was polled.
+static int io_poll(int wait, int seq){
+    struct pollfd fds[NIOPOLL + 1];
+    struct thread *t, **tp, *ready = NULL;
+    int n = 0, nfd, i, timeout = 0;
+    char buf[16];
+
+    if(ioq_head == NULL || __sync_lock_test_and_set(&io_polling, 1))
+        return -1;
+    if(wait){
+        if(io_wake[0] < 0)
+            io_wake_init();
+        io_sleeping = 1;
+        __sync_synchronize();
+        timeout = io_wake[0] >= 0 ? -1 : 1;
+        if(idle_seq != seq)
+            timeout = 0;
+    }
+    spin_lock(&io_lock);
+    for(t = ioq_head; t != NULL && n < NIOPOLL; t = t->next){
+        for(i = 0; i < n && fds[i].fd != t->wfd; i++)
+            ;
+        if(i == n){
+            fds[n].fd = t->wfd;
+            fds[n++].events = 0;
+        }
+        fds[i].events |= t->wevents;
+    }
+    spin_unlock(&io_lock);
+    nfd = n;
+    if(wait){
+        fds[n].fd = io_wake[0];
+        fds[n++].events = POLLIN;
+    }
+    n = poll(fds, n, timeout);
+    io_sleeping = 0;
+    if(wait && fds[nfd].revents)
+        while(read(io_wake[0], buf, sizeof(buf)) > 0)
+            ;
+    if(n > 0){
+        spin_lock(&io_lock);
+        ioq_tail = NULL;
+        for(tp = &ioq_head; (t = *tp) != NULL; ){
+            for(i = 0; i < nfd && fds[i].fd != t->wfd; i++)
+                ;
+            if(i < nfd && (fds[i].revents & (t->wevents | POLLHUP | POLLNVAL))){
+                *tp = t->next;
+                t->wevents = fds[i].revents;
+                t->previous = ready;
+                ready = t;
+            }else{
+                ioq_tail = t;
+                tp = &t->next;
+            }
+        }
+        spin_unlock(&io_lock);
+        while((t = ready) != NULL){
+            ready = t->previous;
+            make_runnable(t);
+        }
+    }
+    __sync_lock_release(&io_polling);
+    return 0;
+}
+
+// Wait until fd is ready for events, running other threads
+// meanwhile. Returns the events that hold, which may include
+// POLLHUP, or -1 if fd is not open. Outside of threads the caller
+// waits in poll().
+int thread_wait_io(int fd, int events){
+    struct pollfd p;
+    struct thread *t;
+
+    p.fd = fd;
+    p.events = events;
+    if(poll(&p, 1, 0) < 0)
+        return -1;
+    if(p.revents == 0 && current_thread == NULL){
+        if(poll(&p, 1, -1) < 0)
+            return -1;
+    }else if(p.revents == 0){
+        preempt_off = 1;
+        t = current_thread;
+        t->wchan = NULL;
+        t->wfd = fd;
+        t->wevents = events;
+        self()->parked = t;
+        yield_current();
+        p.revents = current_thread->wevents;
+        preempt_enable();
+    }
+    return (p.revents & POLLNVAL) ? -1 : p.revents;
+}
+
+// read() or write() fd, waiting while it is not ready. A call that
+// fails with fd ready has failed for another reason, and is only
+// tried once more.
+static int io_rw(int fd, void *buf, int n, int events){
+    struct pollfd p;
+    int r, failed = 0;
+
+    for(;;){
+        if(events == POLLIN)
+            r = read(fd, buf, n);
+        else
+            r = write(fd, buf, n);
+        if(r >= 0)
+            return r;
+        p.fd = fd;
+        p.events = events;
+        if(poll(&p, 1, 0) < 0 || (p.revents & POLLNVAL))
+            return -1;
+        if(p.revents == 0){
+            failed = 0;
+            if(thread_wait_io(fd, events) < 0)
+                return -1;
+        }else if(failed++){
+            return -1;
+        }
+    }
+}
+
+int thread_read(int fd, void *buf, int n){
+    return io_rw(fd, buf, n, POLLIN);
+}
+
+int thread_write(int fd, const void *buf, int n){
+    return io_rw(fd, (void *) buf, n, POLLOUT);
+}
+
+// Finish a switch on the new thread's or task's side: the thread
+// switched away from may now be stolen, and whatever exited
+// before the switch is no longer in use.
+static void finish_switch(void){
+    struct worker *w = self();
+    struct thread *t;
+    struct task *k;
+
+    if(w->prev != NULL){
+        if(w->prev != w->current){
+            __sync_synchronize();
+            w->prev->running = 0;
+        }
+        w->prev = NULL;
+    }
+    if((t = w->parked) != NULL){
+        w->parked = NULL;
+        park_queue(t);
+    }
+    while((t = w->dead) != NULL){
+        w->dead = t->next;
+        thread_free_tasks(t);
+        stack_free(t->stack);
+        thread_free(t);
+    }
+    while((k = w->dead_tasks) != NULL){
+        w->dead_tasks = k->next;
+        task_free(k);
+    }
+}
+
+static void thread_entry(void){
+    finish_switch();
+    preempt_enable();
+    current_thread->fp(current_thread->arg);
+    thread_exit();
 }
+
+// Unlink finished task k from the current thread, to be freed
+// by finish_switch().
+static void task_finish(struct task *k){
+    struct worker *w = self();
+    struct thread *t = w->current;
+    struct task **kp;
+
+    spin_lock(&t->lock);
+    kp = &t->tasks;
+    while(*kp != k)
+        kp = &(*kp)->next;
+    *kp = k->next;
+    spin_unlock(&t->lock);
+    k->next = w->dead_tasks;
+    w->dead_tasks = k;
+}
+
+static void task_entry(void){
+    struct task *k;
+
+    finish_switch();
+    k = current_thread->current_task;
+    preempt_enable();
+    k->fp(k->arg);
+    preempt_off = 1;
+    // Still running on the task's stack (or the run stack), so
+    // it is freed on the far side of dispatch().
+    task_finish(current_thread->current_task);
+    dispatch();
+}
+
 void thread_yield(void){
+    preempt_off = 1;
+    yield_current();
+    preempt_enable();
+}
+
+// Switch away from the running thread or task, returning when it
+// is dispatched again. Called with preempt_off set.
+static void yield_current(void){
     // TODO The function suspends the current thread by saving its context.
-    if(current_thread->num_tasks >= 0 && current_thread->thread_yield == 0){
-        int index = current_thread->current_task;
-        //printf("task yield %d\n", index);
+    if(current_thread->tasks != NULL && current_thread->thread_yield == 0){
+        struct task *k = current_thread->current_task;
         current_thread->task_yield = 1;
-        if(setjmp(current_thread->task_env[index]) == 0){
-            current_thread->task_buf_set[index] = 1;
+        if(setjmp(k->env) == 0){
+            if(k->stack == NULL) // lazy: free the run stack
+                task_save(k);
+            k->buf_set = 1;
             schedule();
             dispatch();
         }else{
-            current_thread->task_buf_set[index] = 0;
-            if(setjmp(current_thread->task_env[index]) == 0){
-                current_thread->task_buf_set[index] = 1;
+            k = current_thread->current_task;
+            k->buf_set = 0;
+            if(setjmp(k->env) == 0){
+                k->buf_set = 1;
             }else{
                 //printf("setjmp setjmp setjmp\n");
             }
         }
     }else{
         //printf("thread yield\n");
-        current_thread->thread_yield = 0;
-        if (setjmp(current_thread->env) == 0){
-            current_thread->buf_set = 1;
-            schedule();
+        struct thread *t = current_thread, *next;
+        t->thread_yield = 0;
+        // t stays marked running until finish_switch(), so nothing
+        // resumes it before its env is saved below.
+        t->buf_set = 1;
+        schedule();
+        next = current_thread;
+        if(next != NULL && next->tasks == NULL &&
+           next->task_yield == 0 && next->buf_set == 1){
+            // Fast path: what dispatch() would do, in one switch.
+            next->thread_yield = 1;
+            if(next != t)
+                swapjmp(t->env, next->env);
+        }else if(setjmp(t->env) == 0){
             dispatch();
-        }else{
-            current_thread->buf_set = 0;
         }
+        current_thread->buf_set = 0;
     }
+    finish_switch();
 }
 void dispatch(void){
     // TODO The function executes a thread
+    if(current_thread == NULL) // all of this worker's threads wait
+        longjmp(self()->idle_env, 1);
     
     // run task
-    while(current_thread->num_tasks >= 0){
-        int i = current_thread->num_tasks;
-        //printf("run task %d\n", i);
-        if (i >= 0) { //double check
-            current_thread->current_task = i;
-            if (current_thread->task_buf_set[i] == 1) { // from round 2
-                longjmp(current_thread->task_env[i], 1);
-            } else if (current_thread->task_buf_set[i] == -1) { // initialize
-                if (setjmp(current_thread->task_env[i]) == 0) {
-                    current_thread->task_env[i]->sp = (unsigned long) current_thread->task_stack_p;
-                    longjmp(current_thread->task_env[i], 1);
-                }
-                current_thread->task_buf_set[i] = 0;
-                current_thread->task_fp[i](current_thread->task_arg[i]); // run task function
+    while(current_thread->tasks != NULL){
+        struct task *k = current_thread->tasks;
+        current_thread->current_task = k;
+        if (k->buf_set == 1) { // from round 2
+            if (k->saved != NULL) { // lazy: copy its frames back first
+                restoring = k;
+                start_on(switch_env, switch_stack_top, restore_entry);
             }
+            longjmp(k->env, 1);
+        } else if (k->buf_set == -1) { // initialize
+            k->buf_set = 0;
+            start_on(k->env, k->stack != NULL ? k->stack_p : run_stack_top,
+                     task_entry); // run task function
         }
-        //free(current_thread->task_stack[current_thread->num_tasks]);
-        current_thread->num_tasks--;
+        task_finish(k);
     }
-    current_thread->current_task = -1;
+    current_thread->current_task = NULL;
     
     // run thread
     if(current_thread->task_yield == 1){ // thread has been yielded from the task
         //printf("task yield resume\n");
         current_thread->task_yield = 0;
+        current_thread->thread_yield = 1;
         if (current_thread->buf_set == 1) { // from round 2
             longjmp(current_thread->env, 1);
         } else {
             if(current_thread->buf_set == -1){ // initialize
-                if(setjmp(current_thread->env)==0){
-                    current_thread->env->sp = (unsigned long)current_thread->stack_p;
-                    longjmp(current_thread->env, 1);
-                }
                 current_thread->buf_set = 0;
-                current_thread->fp(current_thread->arg);
+                start_on(current_thread->env, current_thread->stack_p, thread_entry);
             }
             thread_exit();
         }
@@ -126,13 +1411,9 @@ void dispatch(void){
             longjmp(current_thread->env, 1);
         } else {
             if(current_thread->buf_set == -1){ // initialize
-                if(setjmp(current_thread->env)==0){
-                    current_thread->env->sp = (unsigned long)current_thread->stack_p;
-                    longjmp(current_thread->env, 1);
-                }
                 current_thread->buf_set = 0;
                 current_thread->thread_yield = 1;
-                current_thread->fp(current_thread->arg);
+                start_on(current_thread->env, current_thread->stack_p, thread_entry);
             }
             thread_exit();
         }
@@ -140,51 +1421,151 @@ void dispatch(void){
 }
 void schedule(void){
     // TODO
-    current_thread = current_thread->next;
+    struct worker *w = self();
+
+    if(ioq_head != NULL && ++w->nswitch % IO_POLL_INTERVAL == 0)
+        io_poll(0, 0);
+
+    spin_lock(&w->lock);
+    w->prev = current_thread;
+    if(w->parked != current_thread) // off the queue until unpark()
+        rq_push(w, current_thread);
+    run_next(w);
+    spin_unlock(&w->lock);
 }
 void thread_exit(void){
+    struct worker *w;
+    struct thread *temp;
+
+    preempt_off = 1;
     if (current_thread == NULL) {
+        preempt_off = 0;
         // printf("Error: No current thread to exit.\n");
         return;
     }
-    if(current_thread->next != current_thread){
-        // TODO
-        // printf("Exiting thread...%d\n",current_thread->ID);
-        struct thread *temp = current_thread;
-        current_thread->previous->next = current_thread->next;
-        current_thread->next->previous = current_thread->previous;
-        current_thread = current_thread->next;
-        
-        // Free the task stacks
-        for (int i = 0; i <= temp->num_tasks; i++) {
-            free(temp->task_stack[i]);
-        }
-        free(temp->stack);
-        free(temp);
-        dispatch();
-    }else{
-        // TODO
-        // printf("Exiting last thread...%d\n",current_thread->ID);
-        struct thread *temp = current_thread;
-        
-        // Free the task stacks
-        for (int i = 0; i <= temp->num_tasks; i++) {
-            free(temp->task_stack[i]);
-        }
-        free(temp->stack);
-        free(temp);
-        current_thread = NULL;
+    w = self();
+    temp = current_thread;
+    // printf("Exiting thread...%d\n",current_thread->ID);
+    spin_lock(&w->lock);
+    run_next(w);
+    spin_unlock(&w->lock);
+
+    // Free the tasks and stacks once off them
+    temp->next = w->dead;
+    w->dead = temp;
+
+    if(__sync_sub_and_fetch(&nlive, 1) == 0){
+        // printf("Exiting last thread...%d\n",temp->ID);
         // the illegal way !!!FIX to exit at main!!!
         printf("\nexited\n");
         exit(0);
         // thread_start_threading(); // Return control to the main function
     }
+    if(w->current == NULL) // other workers still have threads
+        longjmp(w->idle_env, 1);
+    dispatch();
 }
+
+// Take a thread that is not running from another worker's queue
+// and make it w's current thread. Returns -1 if there was none.
+static int steal(struct worker *w){
+    struct worker *v;
+    struct thread *t;
+    int i;
+
+    for(i = 1; i < nworkers; i++){
+        v = &workers[(w - workers + i) % nworkers];
+        if(v->nqueued == 0) // a hint, read without the lock
+            continue;
+        spin_lock(&v->lock);
+        t = rq_take(v);
+        spin_unlock(&v->lock);
+        if(t != NULL){
+            t->running = 1;
+            spin_lock(&w->lock);
+            w->current = t;
+            spin_unlock(&w->lock);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Run threads on w until none are left anywhere.
+static void worker_loop(struct worker *w){
+    int seq;
+
+    setjmp(w->idle_env);
+    finish_switch();
+    for(;;){
+        spin_lock(&w->lock);
+        if(w->current == NULL)
+            run_next(w);
+        spin_unlock(&w->lock);
+        if(w->current != NULL)
+            dispatch();
+        __sync_fetch_and_add(&nidle, 1);
+        seq = idle_seq;
+        if(steal(w) < 0){
+            if(nlive == 0 && w == workers){
+                __sync_fetch_and_sub(&nidle, 1);
+                return;
+            }
+            if(io_poll(1, seq) < 0)
+                futex_wait(&idle_seq, seq);
+        }
+        __sync_fetch_and_sub(&nidle, 1);
+    }
+}
+
+static void worker_main(void *arg){
+    struct worker *w = arg;
+
+    set_self(w);
+    w->no_preempt = 1;
+    if(quantum > 0)
+        sigalarm(quantum, alarm_handler);
+    worker_loop(w);
+}
+
+// Run threads on n kernel threads, from the next call to
+// thread_start_threading(). Call it before assigning tasks, which
+// are not lazy with more than one worker. Returns -1 if n is out
+// of range.
+int thread_set_workers(int n){
+    if(n < 1 || n > NWORKER || mn)
+        return -1;
+    nworkers = n;
+    return 0;
+}
+
 void thread_start_threading(void){
     // TODO
-    while(current_thread != NULL){
-        dispatch();
+    void *s;
+    int i;
+
+    preempt_off = 1;
+    if(nworkers > 1 && nlive > 0){
+        io_wake_init();
+        set_self(&workers[0]);
+        mn = 1;
+        for(i = 1; i < nworkers; i++){
+            s = stack_alloc_class(size_class(WORKER_STACK_SIZE));
+            if(s == NULL || clone(worker_main, &workers[i], stack_top(s)) < 0){
+                if(s != NULL)
+                    stack_free(s);
+                fprintf(2, "threads: cannot start worker %d\n", i);
+                nworkers = i;
+                break;
+            }
+        }
     }
+    if(quantum > 0 && nlive > 0)
+        sigalarm(quantum, alarm_handler);
+    worker_loop(&workers[0]);
+    preempt_off = 0;
+    if(quantum > 0)
+        sigalarm(0, 0);
     // printf("All threads exited.\n");
     return;
 }
@@ -192,15 +1573,33 @@ void thread_start_threading(void){
 // part 2
 void thread_assign_task(struct thread *t, void (*f)(void *), void *arg){
     // TODO
-    unsigned long new_stack = (unsigned long) malloc(sizeof(unsigned long)*0x100);
-    unsigned long new_stack_p = new_stack +0x100*8-0x2*8;
-    t->num_tasks++;
-    // printf("assigning task %d\n",t->num_tasks);
-    t->task_fp[t->num_tasks] = f;
-    t->task_arg[t->num_tasks] = arg;
-    t->task_stack[t->num_tasks] = (void*) new_stack;
-    t->task_stack_p[t->num_tasks] = (void*) new_stack_p;
-    t->task_buf_set[t->num_tasks] = -1;
+    struct task *k;
+    void *new_stack = NULL;
+    preempt_off = 1;
+    k = task_alloc();
+    if(k == NULL ||
+       ((!lazy_tasks || nworkers > 1 || run_stack_init() < 0) &&
+        (new_stack = stack_alloc()) == NULL)){
+        if(k != NULL){
+            k->stack = NULL;
+            k->saved = NULL;
+            task_free(k);
+        }
+        preempt_enable();
+        fprintf(2, "threads: out of memory for task\n");
+        return;
+    }
+    k->fp = f;
+    k->arg = arg;
+    k->stack = new_stack;
+    k->stack_p = new_stack != NULL ? stack_top(new_stack) : NULL;
+    k->saved = NULL;
+    k->buf_set = -1;
+    spin_lock(&t->lock);
+    k->next = t->tasks;
+    t->tasks = k;
+    spin_unlock(&t->lock);
+    preempt_enable();
 }
 
 /*
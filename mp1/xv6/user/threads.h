@@ -4,6 +4,23 @@
 // TODO: necessary includes, if any
 #include "user/setjmp.h"
 // TODO: necessary defines, if any
+#ifndef THREAD_STACK_SIZE
+#define THREAD_STACK_SIZE (0x100*8) // default stack size, in bytes
+#endif
+
+// A task assigned to a thread. A thread's tasks form a stack,
+// most recently assigned first, and run last come first served.
+struct task {
+    void (*fp)(void *arg);
+    void *arg;
+    void *stack; // own stack, or NULL to run on the shared run stack
+    void *stack_p;
+    void *saved; // frames copied off the run stack while suspended
+    int saved_len;
+    jmp_buf env;
+    int buf_set; // 1: env set, 0: running, -1: not started
+    struct task *next; // task assigned before this one
+};
 
 struct thread {
     void (*fp)(void *arg);
@@ -13,17 +30,20 @@ struct thread {
     jmp_buf env; // for thread function
     int buf_set; // 1: indicate jmp_buf (env) has been set, 0: indicate jmp_buf (env) not set
     // TASK variables
-    void (*task_fp[20])(void *task_arg);
-    void *task_arg[20];
-    void *task_stack[20];
-    void *task_stack_p[20];
-    jmp_buf task_env[20];
-    int task_buf_set[20];
-    int num_tasks; // Number of tasks associated with the thread
-    int current_task;
+    struct task *tasks; // pending tasks, most recent first
+    struct task *current_task;
     int task_yield; // flag to indicate task_yield
     int thread_yield; // flag to indicate thread_yield
     int ID;
+    volatile int running; // on a worker, or being switched away from
+    volatile int lock; // guards tasks against thread_assign_task()
+    volatile int *wchan; // word waited on in thread_futex_wait()
+    int wval;
+    int wfd; // descriptor waited on in thread_wait_io()
+    int wevents; // events waited for, then those that hold
+    int priority; // THREAD_SCHED_PRIO: lower runs first
+    int deadline; // THREAD_SCHED_EDF: earlier runs first
+    int seq; // arrival order in a run queue heap
     struct thread *previous;
     struct thread *next;
 };
@@ -38,4 +58,93 @@ void thread_start_threading(void);
 
 // part 2
 void thread_assign_task(struct thread *t, void (*f)(void *), void *arg);
+
+int thread_set_stack_size(int size);
+// Off by default. A lazy task must not hand the address of one
+// of its locals to another thread: the object is not there while
+// the task is suspended.
+int thread_set_lazy_tasks(int on);
+// Set it before creating threads: while a quantum is set, new
+// stacks get room for the alarm on top of the size asked for.
+void thread_set_quantum(int ticks);
+int thread_set_workers(int n);
+
+// Scheduling policies, for thread_set_policy().
+#define THREAD_SCHED_RR   0 // round robin, the default
+#define THREAD_SCHED_PRIO 1 // lowest priority first, round robin among equals
+#define THREAD_SCHED_EDF  2 // earliest deadline first
+#define THREAD_NO_DEADLINE 0x7fffffff
+
+int thread_set_policy(int policy);
+void thread_set_priority(struct thread *t, int priority);
+void thread_set_deadline(struct thread *t, int deadline);
+
+// Blocking synchronization. A waiting thread leaves its worker
+// free to run others until it is woken.
+struct thread_mutex {
+    volatile int state;
+};
+
+struct thread_cond {
+    volatile int seq;
+};
+
+struct thread_sem {
+    volatile int count;
+    volatile int waiters;
+};
+
+int thread_futex_wait(volatile int *addr, int val);
+int thread_futex_wake(volatile int *addr, int n);
+void thread_mutex_init(struct thread_mutex *m);
+void thread_mutex_lock(struct thread_mutex *m);
+void thread_mutex_unlock(struct thread_mutex *m);
+void thread_cond_init(struct thread_cond *c);
+void thread_cond_wait(struct thread_cond *c, struct thread_mutex *m);
+void thread_cond_signal(struct thread_cond *c);
+void thread_cond_broadcast(struct thread_cond *c);
+void thread_sem_init(struct thread_sem *s, int count);
+void thread_sem_wait(struct thread_sem *s);
+void thread_sem_post(struct thread_sem *s);
+// Bounded channels of fixed-size messages, safe for any number of
+// senders and receivers. Senders wait while a channel is full and
+// receivers while it is empty.
+struct thread_chan {
+    struct thread_mutex lock;
+    struct thread_cond notfull, notempty;
+    void *mem; // pooled buffer
+    char *buf; // ring of cap messages of size bytes
+    int cap, size;
+    int head, count;
+    int closed;
+    int nsend, nrecv; // waiting
+};
+
+int thread_chan_init(struct thread_chan *c, int cap, int size);
+int thread_chan_send(struct thread_chan *c, const void *msg);
+int thread_chan_recv(struct thread_chan *c, void *msg);
+void thread_chan_close(struct thread_chan *c);
+void thread_chan_destroy(struct thread_chan *c);
+
+// A fixed set of threads running submitted closures.
+struct thread_pool {
+    struct thread_chan jobs;
+    volatile int pending; // submitted and not yet returned
+    volatile int nthreads; // still running
+    struct thread_mutex lock;
+    struct thread_cond done;
+};
+
+int thread_pool_init(struct thread_pool *p, int nthreads, int queue);
+int thread_pool_submit(struct thread_pool *p, void (*fn)(void *), void *arg);
+void thread_pool_wait(struct thread_pool *p);
+void thread_pool_shutdown(struct thread_pool *p);
+
+// I/O that parks the calling thread, not its worker, while fd is
+// not ready. Events are POLLIN and POLLOUT from kernel/poll.h. fd
+// should be O_NONBLOCK, or read() and write() may still block.
+int thread_wait_io(int fd, int events);
+int thread_read(int fd, void *buf, int n);
+int thread_write(int fd, const void *buf, int n);
+
 #endif // THREADS_H_
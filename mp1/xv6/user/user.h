@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct lockstat;
+struct pollfd;
 
 // system calls
 int fork(void);
@@ -23,6 +25,16 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int setpriority(int, int);
+int cputime(int);
+int lockstat(struct lockstat*, int);
+int sigalarm(int, void (*)(void*));
+int sigreturn(void*);
+int clone(void (*)(void*), void*, void*);
+int futex_wait(volatile int*, int);
+int futex_wake(volatile int*, int);
+int fcntl(int, int, int);
+int poll(struct pollfd*, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
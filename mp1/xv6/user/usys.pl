@@ -36,3 +36,13 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("setpriority");
+entry("cputime");
+entry("lockstat");
+entry("sigalarm");
+entry("sigreturn");
+entry("clone");
+entry("futex_wait");
+entry("futex_wake");
+entry("fcntl");
+entry("poll");
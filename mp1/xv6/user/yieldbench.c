@@ -0,0 +1,58 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "user/threads.h"
+
+// Measure thread_yield(): nthreads threads each yield nyields
+// times, and the rate is taken from uptime().
+// usage: yieldbench [nthreads [nyields [nworkers]]]
+
+#define TICKS_PER_SEC 10  // timer interval set in start.c, in qemu
+
+int nthreads = 2;
+int nyields = 200000;
+volatile int left;
+int start;
+
+void
+yielder(void *arg)
+{
+  int i, t, total;
+
+  for(i = 0; i < nyields; i++)
+    thread_yield();
+  if(__sync_sub_and_fetch(&left, 1) == 0){
+    t = uptime() - start;
+    total = nthreads * nyields;
+    printf("%d yields in %d ticks", total, t);
+    if(t > 0)
+      printf(", %d yields/s", total / t * TICKS_PER_SEC);
+    printf("\n");
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  int i;
+
+  if(argc > 1)
+    nthreads = atoi(argv[1]);
+  if(argc > 2)
+    nyields = atoi(argv[2]);
+  if(argc > 3 && thread_set_workers(atoi(argv[3])) < 0){
+    fprintf(2, "yieldbench: bad worker count %s\n", argv[3]);
+    exit(1);
+  }
+  if(nthreads < 1 || nyields < 1){
+    fprintf(2, "usage: yieldbench [nthreads [nyields [nworkers]]]\n");
+    exit(1);
+  }
+
+  left = nthreads;
+  for(i = 0; i < nthreads; i++)
+    thread_add_runqueue(thread_create(yielder, 0));
+  start = uptime();
+  thread_start_threading();
+  exit(0);
+}
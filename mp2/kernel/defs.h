@@ -8,6 +8,8 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct seg;
+struct vma;
 
 // bio.c
 void            binit(void);
@@ -26,6 +28,9 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+struct seg*     seg_lookup(struct proc*, uint64);
+int             seg_fault(struct proc*, struct seg*, uint64, int);
+void            seg_prefault(struct proc*, uint64, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -35,6 +40,7 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filesplice(struct file*, uint64, int n);
 
 // fs.c
 void            fsinit(int);
@@ -78,6 +84,7 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipesplice(struct pipe*, uint64, int, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -193,6 +200,23 @@ void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
 void            virtio_disk_intr(void);
 
+// mmap.c
+uint64          vma_base(struct proc*);
+struct vma*     vma_lookup(struct proc*, uint64);
+int             vma_fault(struct proc*, struct vma*, uint64, int);
+void            vma_unmapall(struct proc*);
+int             vma_fork(struct proc*, struct proc*);
+uint64          mmap(struct file*, uint64, int, int, uint);
+int             munmap(uint64, uint64);
+
+// pcache.c
+void            pcacheinit(void);
+char*           pcache_get(struct inode*, uint);
+void            pcache_put(char*);
+void            pcache_write(struct inode*, uint, char*, uint);
+void            pcache_inval(struct inode*);
+int             pcache_reclaim(void);
+
 // paging.c
 int handle_pgfault();
 int demand_page(uint64 va);
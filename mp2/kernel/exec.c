@@ -4,10 +4,14 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "defs.h"
 #include "elf.h"
 
 static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+static int segmap(pagetable_t, struct seg*, struct inode*, uint64, int);
 
 int
 exec(char *path, char **argv)
@@ -16,8 +20,9 @@ exec(char *path, char **argv)
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct seg segs[NSEG];
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -37,6 +42,7 @@ exec(char *path, char **argv)
 
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
+  memset(segs, 0, sizeof(segs));
 
   // Load program into memory.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
@@ -48,6 +54,24 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
+#ifdef DEMAND_EXEC
+    // Map nothing yet; seg_fault() reads pages in on first touch.
+    if((ph.vaddr % PGSIZE) != 0 || ph.memsz == 0)
+      goto bad;
+    for(struct seg *s = segs; ; s++){
+      if(s == &segs[NSEG])
+        goto bad;
+      if(s->memsz == 0){
+        s->va = ph.vaddr;
+        s->memsz = ph.memsz;
+        s->filesz = ph.filesz;
+        s->off = ph.off;
+        break;
+      }
+    }
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
+#else
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
       goto bad;
@@ -56,10 +80,28 @@ exec(char *path, char **argv)
       goto bad;
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
+#endif
+  }
+#ifdef DEMAND_EXEC
+  // The first instruction faults on the entry page anyway;
+  // read it now while ip is locked.
+  for(i = 0; i < NSEG; i++){
+    if(elf.entry >= segs[i].va && elf.entry < segs[i].va + segs[i].memsz){
+      if(segmap(pagetable, &segs[i], ip, PGROUNDDOWN(elf.entry), 1) < 0)
+        goto bad;
+      break;
+    }
   }
+  // Keep the reference: later faults read from ip.
+  iunlock(ip);
+  end_op();
+  exe = ip;
+  ip = 0;
+#else
   iunlockput(ip);
   end_op();
   ip = 0;
+#endif
 
   p = myproc();
   uint64 oldsz = p->sz;
@@ -109,12 +151,21 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  vma_unmapall(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  oldexe = p->exe;
+  p->exe = exe;
+  memmove(p->seg, segs, sizeof(segs));
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -125,6 +176,11 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
@@ -152,3 +208,110 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
   
   return 0;
 }
+
+// Fill the page mem, to be mapped at va, from segment s of ip:
+// the segment's file bytes, then zeros.  With ip locked the file
+// is read directly; otherwise the bytes come through the page
+// cache, so a program run again does not go back to the disk.
+// Each process gets its own copy: programs are linked -N into one
+// writable segment whose file offset is not page aligned, so a
+// cached page cannot be mapped as is.
+static int
+segfill(struct seg *s, struct inode *ip, uint64 va, char *mem, int locked)
+{
+  uint64 end;
+  uint off, base, n, m, i;
+  char *pa;
+
+  memset(mem, 0, PGSIZE);
+  end = s->va + s->filesz;
+  if(va >= end)
+    return 0;
+  n = (end - va < PGSIZE) ? end - va : PGSIZE;
+  off = s->off + (va - s->va);
+
+  if(locked)
+    return readi(ip, 0, (uint64)mem, off, n) == n ? 0 : -1;
+
+  for(i = 0; i < n; i += m, off += m){
+    base = PGROUNDDOWN(off);
+    if((pa = pcache_get(ip, base)) == 0)
+      return -1;
+    m = base + PGSIZE - off;
+    if(m > n - i)
+      m = n - i;
+    memmove(mem + i, pa + (off - base), m);
+    pcache_put(pa);
+  }
+  return 0;
+}
+
+// Read in and map the page at va of segment s.
+static int
+segmap(pagetable_t pagetable, struct seg *s, struct inode *ip, uint64 va, int locked)
+{
+  char *mem;
+
+  mem = kalloc();
+  if(mem == 0 && pcache_reclaim())
+    mem = kalloc();
+  if(mem == 0)
+    return -1;
+  if(segfill(s, ip, va, mem, locked) < 0 ||
+     mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Return the program segment of p holding va, or 0.
+struct seg*
+seg_lookup(struct proc *p, uint64 va)
+{
+  struct seg *s;
+
+  if(p->exe == 0 || va >= p->sz)
+    return 0;
+  for(s = p->seg; s < &p->seg[NSEG]; s++)
+    if(s->memsz && va >= s->va && va < s->va + s->memsz)
+      return s;
+  return 0;
+}
+
+// Read in the page at va of segment s of p, which is not mapped.
+// If the caller cannot sleep, only pages with no file bytes
+// (all bss) can be handled.
+int
+seg_fault(struct proc *p, struct seg *s, uint64 va, int cansleep)
+{
+  va = PGROUNDDOWN(va);
+  if(!cansleep && va < s->va + s->filesz)
+    return -1;
+  // A copyout() inside readi() of our own program already
+  // holds its lock.
+  return segmap(p->pagetable, s, p->exe, va, holdingsleep(&p->exe->lock));
+}
+
+// Read in the program pages of [va, va+len) that p has not
+// touched yet.  System calls that copy to or from user memory
+// while holding a lock call this first: under a spinlock
+// walkaddr() cannot read the file, and under another inode's
+// lock taking p->exe's could deadlock.
+void
+seg_prefault(struct proc *p, uint64 va, uint64 len)
+{
+  uint64 a;
+  pte_t *pte;
+  struct seg *s;
+
+  if(p->exe == 0 || len == 0 || va + len < va)
+    return;
+  for(a = PGROUNDDOWN(va); a < va + len && a < p->sz; a += PGSIZE){
+    if((s = seg_lookup(p, a)) == 0)
+      continue;
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & (PTE_V | PTE_S)) == 0)
+      seg_fault(p, s, a, 1);
+  }
+}
@@ -111,6 +111,8 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->readable == 0)
     return -1;
 
+  // The copy happens under the pipe's, console's or inode's lock.
+  seg_prefault(myproc(), addr, n);
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -139,6 +141,7 @@ filewrite(struct file *f, uint64 addr, int n)
   if(f->writable == 0)
     return -1;
 
+  seg_prefault(myproc(), addr, n);
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -180,3 +183,16 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+
+// Move n bytes between user address addr and pipe f without
+// copying whole aligned pages; see pipesplice().
+int
+filesplice(struct file *f, uint64 addr, int n)
+{
+  if(f->type != FD_PIPE)
+    return -1;
+  seg_prefault(myproc(), addr, n);
+  if(f->writable)
+    return pipesplice(f->pipe, addr, n, 1);
+  return pipesplice(f->pipe, addr, n, 0);
+}
@@ -433,6 +433,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcache_inval(ip);
 }
 
 // Copy stat information from inode.
@@ -500,6 +501,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    pcache_write(ip, off, (char*)bp->data + (off % BSIZE), m);
     //log_write(bp);
     brelse(bp);
   }
@@ -28,6 +28,7 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    pcacheinit();    // file page cache
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
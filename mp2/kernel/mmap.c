@@ -0,0 +1,298 @@
+// Memory-mapped files.
+//
+// mmap() records a region in p->vma[] and maps nothing; pages
+// arrive one at a time through vma_fault().  MAP_SHARED regions map
+// the page cache's copy of the file directly, so every process
+// mapping the file sees the same bytes, and dirty pages are written
+// back to the file when they are unmapped.  MAP_PRIVATE regions get
+// a private copy of the cached page.
+//
+// Regions are placed top-down below the trapframe, above p->sz.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+// Lowest address used by any region of p, or TRAPFRAME if none.
+// The heap may not grow past it.
+uint64
+vma_base(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = TRAPFRAME;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->addr && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Return the region of p containing va, or 0.
+struct vma*
+vma_lookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->addr && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Handle a fault at va inside region v.
+// Returns 0 on success, -1 if the process should be killed.
+int
+vma_fault(struct proc *p, struct vma *v, uint64 va, int write)
+{
+  pte_t *pte;
+  char *pa, *mem;
+  int perm;
+
+  va = PGROUNDDOWN(va);
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    // Already mapped; the hardware wants the dirty bit set
+    // by software.
+    if(!write || (*pte & PTE_W) == 0)
+      return -1;
+    *pte |= PTE_A | PTE_D;
+    sfence_vma();
+    return 0;
+  }
+
+  if((pa = pcache_get(v->f->ip, v->off + (va - v->addr))) == 0)
+    return -1;
+
+  perm = PTE_U | PTE_A;
+  if(v->prot & (PROT_READ | PROT_WRITE))
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  if(v->flags & MAP_PRIVATE){
+    mem = kalloc();
+    if(mem == 0 && pcache_reclaim())
+      mem = kalloc();
+    if(mem == 0){
+      pcache_put(pa);
+      return -1;
+    }
+    memmove(mem, pa, PGSIZE);
+    pcache_put(pa);
+    pa = mem;
+  } else if(write){
+    perm |= PTE_D;
+  }
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)pa, perm) != 0){
+    if(v->flags & MAP_PRIVATE)
+      kfree(pa);
+    else
+      pcache_put(pa);
+    return -1;
+  }
+  return 0;
+}
+
+// Write the shared page pa, mapped at va in v, back to the file.
+// Only bytes inside the file are written; the file never grows.
+static void
+vma_writeback(struct vma *v, uint64 va, char *pa)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->addr);
+  // same transaction budget as filewrite().
+  uint max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint i, n;
+
+  for(i = 0; i < PGSIZE; i += n){
+    n = PGSIZE - i;
+    if(n > max)
+      n = max;
+    begin_op();
+    ilock(ip);
+    if(off + i >= ip->size){
+      n = PGSIZE - i;
+    } else {
+      if(off + i + n > ip->size)
+        n = ip->size - (off + i);
+      writei(ip, 0, (uint64)pa + i, off + i, n);
+    }
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Remove the pages of [va, va+len) in v from p's page table.
+static void
+vma_unmap(struct proc *p, struct vma *v, uint64 va, uint64 len)
+{
+  uint64 a;
+  pte_t *pte;
+  char *pa;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    pa = (char*)PTE2PA(*pte);
+    if(v->flags & MAP_PRIVATE){
+      kfree(pa);
+    } else {
+      if(*pte & PTE_D)
+        vma_writeback(v, a, pa);
+      pcache_put(pa);
+    }
+    *pte = 0;
+  }
+}
+
+// Unmap every region of p and drop its files.
+// Called by exit() and exec().
+void
+vma_unmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0)
+      continue;
+    vma_unmap(p, v, v->addr, v->len);
+    fileclose(v->f);
+    v->addr = 0;
+  }
+}
+
+// Give the child np of fork() the regions of p.
+// Shared pages fault in from the page cache as usual; resident
+// private pages are copied now, since they may differ from the file.
+// Must not sleep: fork() holds np->lock.
+int
+vma_fork(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  uint64 a;
+  pte_t *pte;
+  char *mem;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0 || (v->flags & MAP_PRIVATE) == 0)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if((mem = kalloc()) == 0)
+        goto bad;
+      memmove(mem, (char*)PTE2PA(*pte), PGSIZE);
+      if(mappages(np->pagetable, a, PGSIZE, (uint64)mem, PTE_FLAGS(*pte)) != 0){
+        kfree(mem);
+        goto bad;
+      }
+    }
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr){
+      np->vma[v - p->vma] = *v;
+      filedup(v->f);
+    }
+  }
+  return 0;
+
+ bad:
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0 || (v->flags & MAP_PRIVATE) == 0)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(np->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      kfree((void*)PTE2PA(*pte));
+      *pte = 0;
+    }
+  }
+  return -1;
+}
+
+// Map len bytes of f starting at off.
+// Returns the address of the region, or -1.
+uint64
+mmap(struct file *f, uint64 len, int prot, int flags, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+  uint64 addr;
+
+  if(f->type != FD_INODE || len == 0 || off % PGSIZE != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if((prot & (PROT_READ | PROT_EXEC)) && !f->readable)
+    return -1;
+  if((prot & PROT_WRITE) && (!f->readable || (flags == MAP_SHARED && !f->writable)))
+    return -1;
+
+  nv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0){
+      nv = v;
+      break;
+    }
+  }
+  if(nv == 0)
+    return -1;
+
+  len = PGROUNDUP(len);
+  addr = vma_base(p);
+  if(addr < len || addr - len < PGROUNDUP(p->sz))
+    return -1;
+  addr -= len;
+
+  nv->addr = addr;
+  nv->len = len;
+  nv->prot = prot;
+  nv->flags = flags;
+  nv->f = filedup(f);
+  nv->off = off;
+  return addr;
+}
+
+// Unmap [addr, addr+len), which must be the start, the end,
+// or the whole of one region.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if((v = vma_lookup(p, addr)) == 0 || addr + len > v->addr + v->len)
+    return -1;
+  if(addr != v->addr && addr + len != v->addr + v->len)
+    return -1;
+
+  vma_unmap(p, v, addr, len);
+  if(len == v->len){
+    fileclose(v->f);
+    v->addr = 0;
+  } else if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+    v->len -= len;
+  } else {
+    v->len -= len;
+  }
+  return 0;
+}
@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "defs.h"
 #include "proc.h"
+#include "fcntl.h"
 
 /* NTU OS 2024 */
 /* Allocate eight consecutive disk blocks. */
@@ -40,6 +41,15 @@ int handle_pgfault() {
   va = PGROUNDDOWN(va);
   //printf("va = PGROUNDDOWN(va);\n");
   
+  // Pages of mmap()ed files come from the page cache.  An
+  // instruction fetch (scause 12) reads, and needs PROT_EXEC.
+  struct vma *v = vma_lookup(p, va);
+  if (v) {
+    if (r_scause() == 12 && (v->prot & PROT_EXEC) == 0)
+      return -1;
+    return vma_fault(p, v, va, r_scause() == 15);
+  }
+
   // Find the page table entry corresponding to the virtual address
   pte_t *pte = walk(p->pagetable, va, 1);
   //printf("error on *pte %p\n", pte);
@@ -47,8 +57,15 @@ int handle_pgfault() {
   if (!pte)
     panic("handle_page_fault: walk failed");
 
+  // Program pages exec() left for first touch come from the file.
+  struct seg *s = seg_lookup(p, va);
+  if (s && !(*pte & PTE_S))
+    return seg_fault(p, s, va, 1);
+
   // Allocate a physical page for the offending virtual address
   char *pa = kalloc();
+  if (!pa && pcache_reclaim())
+    pa = kalloc();
   if (!pa)
     panic("handle_page_fault: kalloc failed");
 
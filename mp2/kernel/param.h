@@ -11,3 +11,6 @@
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define NSEG         4     // loadable segments per program
+#define NVMA         16    // mmap() regions per process
+#define NPCACHE      64    // pages in the file page cache
@@ -0,0 +1,257 @@
+// Page cache.
+//
+// Holds whole pages of file contents, keyed by (dev, inum, offset),
+// so that every mmap() of a file shares one physical copy and a page
+// read once is still there for the next mapping.
+//
+// A page with ref > 0 is mapped by at least one process.  Unmapped
+// pages stay cached on an LRU list; they are the first thing reused
+// when the cache is full and are given back by pcache_reclaim() when
+// kalloc() runs dry.
+//
+// Truncating a file drops its unmapped pages and unhashes the mapped
+// ones, which are then freed by the last pcache_put().
+//
+// writei() calls pcache_write() so cached pages never go stale.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NPHASH 31
+#define PHASH(dev, inum, off) (((dev)*31 + (inum)*17 + (off)/PGSIZE) % NPHASH)
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint off;               // page-aligned offset within the file
+  char *pa;               // cached page, 0 if the entry is free
+  int ref;                // PTEs mapping pa
+  int busy;               // being read in from the file
+  int hashed;             // findable by (dev, inum, off)
+  struct cpage *hnext;    // hash chain
+  struct cpage *prev;     // LRU list of unmapped pages
+  struct cpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+  struct cpage *bucket[NPHASH];
+
+  // Unmapped pages, most recently used at lru.next.
+  struct cpage lru;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.lru.prev = &pcache.lru;
+  pcache.lru.next = &pcache.lru;
+}
+
+static void
+lru_remove(struct cpage *e)
+{
+  e->next->prev = e->prev;
+  e->prev->next = e->next;
+}
+
+static void
+lru_push(struct cpage *e)
+{
+  e->next = pcache.lru.next;
+  e->prev = &pcache.lru;
+  pcache.lru.next->prev = e;
+  pcache.lru.next = e;
+}
+
+static void
+unhash(struct cpage *e)
+{
+  struct cpage **pp;
+
+  for(pp = &pcache.bucket[PHASH(e->dev, e->inum, e->off)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == e){
+      *pp = e->hnext;
+      break;
+    }
+  }
+  e->hashed = 0;
+}
+
+// Return the cached page of ip at page-aligned offset off,
+// reading it in on a miss, with a reference held for the caller.
+// Bytes past the end of the file read as zero.
+// Returns 0 if no page could be found for it.
+// Caller must not hold ip->lock.
+char*
+pcache_get(struct inode *ip, uint off)
+{
+  struct cpage *e, *f;
+  char *pa;
+
+  acquire(&pcache.lock);
+again:
+  for(e = pcache.bucket[PHASH(ip->dev, ip->inum, off)]; e; e = e->hnext){
+    if(e->dev == ip->dev && e->inum == ip->inum && e->off == off){
+      if(e->busy){
+        sleep(e, &pcache.lock);
+        goto again;
+      }
+      if(e->ref++ == 0)
+        lru_remove(e);
+      release(&pcache.lock);
+      return e->pa;
+    }
+  }
+
+  // Miss.  Take a free entry, or else recycle the least
+  // recently used unmapped page.
+  e = 0;
+  for(f = pcache.page; f < &pcache.page[NPCACHE]; f++){
+    if(f->pa == 0){
+      e = f;
+      break;
+    }
+  }
+  pa = 0;
+  if(e)
+    pa = kalloc();
+  if(pa == 0 && pcache.lru.prev != &pcache.lru){
+    f = pcache.lru.prev;
+    lru_remove(f);
+    unhash(f);
+    pa = f->pa;
+    f->pa = 0;
+    if(e == 0)
+      e = f;
+  }
+  if(pa == 0){
+    release(&pcache.lock);
+    return 0;
+  }
+
+  e->dev = ip->dev;
+  e->inum = ip->inum;
+  e->off = off;
+  e->pa = pa;
+  e->ref = 1;
+  e->busy = 1;
+  e->hashed = 1;
+  e->hnext = pcache.bucket[PHASH(e->dev, e->inum, off)];
+  pcache.bucket[PHASH(e->dev, e->inum, off)] = e;
+  release(&pcache.lock);
+
+  memset(pa, 0, PGSIZE);
+  ilock(ip);
+  if(off < ip->size)
+    readi(ip, 0, (uint64)pa, off, PGSIZE);
+  iunlock(ip);
+
+  acquire(&pcache.lock);
+  e->busy = 0;
+  wakeup(e);
+  release(&pcache.lock);
+  return pa;
+}
+
+// Drop a reference taken by pcache_get().
+void
+pcache_put(char *pa)
+{
+  struct cpage *e;
+
+  acquire(&pcache.lock);
+  for(e = pcache.page; e < &pcache.page[NPCACHE]; e++)
+    if(e->pa == pa)
+      break;
+  if(e == &pcache.page[NPCACHE] || e->ref < 1)
+    panic("pcache_put");
+  if(--e->ref == 0){
+    if(e->hashed){
+      lru_push(e);
+    } else {
+      // Orphaned by pcache_inval() while mapped.
+      e->pa = 0;
+      release(&pcache.lock);
+      kfree(pa);
+      return;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Copy n bytes just written at off in ip into any cached page.
+// Called by writei() with ip->lock held.
+void
+pcache_write(struct inode *ip, uint off, char *src, uint n)
+{
+  struct cpage *e;
+  uint base = PGROUNDDOWN(off);
+
+  acquire(&pcache.lock);
+  for(e = pcache.bucket[PHASH(ip->dev, ip->inum, base)]; e; e = e->hnext){
+    if(e->dev == ip->dev && e->inum == ip->inum && e->off == base){
+      // A write never crosses a block, and so never a page.
+      memmove(e->pa + (off - base), src, n);
+      break;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Forget the cached pages of ip, which is being truncated.
+void
+pcache_inval(struct inode *ip)
+{
+  struct cpage *e;
+  char *pa;
+
+  acquire(&pcache.lock);
+again:
+  for(e = pcache.page; e < &pcache.page[NPCACHE]; e++){
+    if(e->pa == 0 || !e->hashed || e->dev != ip->dev || e->inum != ip->inum)
+      continue;
+    unhash(e);
+    if(e->ref == 0){
+      lru_remove(e);
+      pa = e->pa;
+      e->pa = 0;
+      release(&pcache.lock);
+      kfree(pa);
+      acquire(&pcache.lock);
+      goto again;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Free the least recently used unmapped page.
+// Returns 1 if a page was freed, 0 if there was none.
+int
+pcache_reclaim(void)
+{
+  struct cpage *e;
+  char *pa;
+
+  acquire(&pcache.lock);
+  if((e = pcache.lru.prev) == &pcache.lru){
+    release(&pcache.lock);
+    return 0;
+  }
+  lru_remove(e);
+  unhash(e);
+  pa = e->pa;
+  e->pa = 0;
+  release(&pcache.lock);
+  kfree(pa);
+  return 1;
+}
@@ -7,22 +7,33 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
 
-#define PIPESIZE 512
+// The ring is PIPEPAGES separate pages, so a page-aligned,
+// page-sized span can be traded with a user page by pipesplice()
+// instead of copied.
+#define PIPEPAGES 4
+#define PIPESIZE (PIPEPAGES*PGSIZE)
+
+// Ring page holding byte number i.
+#define PIPEPAGE(pi, i) ((pi)->page[((i) / PGSIZE) % PIPEPAGES])
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int nrsleep;    // readers asleep on nread
+  int nwsleep;    // writers asleep on nwrite
 };
 
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *pi;
+  int i;
 
   pi = 0;
   *f0 = *f1 = 0;
@@ -30,10 +41,17 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  for(i = 0; i < PIPEPAGES; i++)
+    pi->page[i] = 0;
+  for(i = 0; i < PIPEPAGES; i++)
+    if((pi->page[i] = kalloc()) == 0)
+      goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->nrsleep = 0;
+  pi->nwsleep = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -46,8 +64,12 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
+  if(pi){
+    for(i = 0; i < PIPEPAGES; i++)
+      if(pi->page[i])
+        kfree(pi->page[i]);
     kfree((char*)pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -58,6 +80,8 @@ pipealloc(struct file **f0, struct file **f1)
 void
 pipeclose(struct pipe *pi, int writable)
 {
+  int i;
+
   acquire(&pi->lock);
   if(writable){
     pi->writeopen = 0;
@@ -68,15 +92,42 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    for(i = 0; i < PIPEPAGES; i++)
+      kfree(pi->page[i]);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
-int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+// Return the PTE of p's page at va if its physical page may be
+// traded for a ring page, or 0.  Pages of MAP_SHARED regions
+// belong to the page cache and must stay put.
+static pte_t*
+giftable(struct proc *p, uint64 va)
+{
+  pte_t *pte;
+  struct vma *v;
+  int need = PTE_V | PTE_U | PTE_R | PTE_W;
+
+  if(va >= MAXVA)
+    return 0;
+  if((v = vma_lookup(p, va)) != 0 && (v->flags & MAP_SHARED))
+    return 0;
+  if((pte = walk(p->pagetable, va, 0)) == 0 || (*pte & need) != need)
+    return 0;
+  return pte;
+}
+
+// Write n bytes from user address addr.  Copies a contiguous span
+// per step; with gift, whole aligned pages are traded instead:
+// the ring takes the user's page and the user gets a zeroed one.
+static int
+pipeput(struct pipe *pi, uint64 addr, int n, int gift)
 {
   int i = 0;
+  uint m;
+  char *pa;
+  pte_t *pte;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -86,28 +137,50 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       return -1;
     }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+      if(pi->nrsleep)
+        wakeup(&pi->nread);
+      pi->nwsleep++;
       sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwsleep--;
+      continue;
+    }
+    m = n - i;
+    if(m > PIPESIZE - (pi->nwrite - pi->nread))
+      m = PIPESIZE - (pi->nwrite - pi->nread);
+    if(m > PGSIZE - pi->nwrite % PGSIZE)
+      m = PGSIZE - pi->nwrite % PGSIZE;
+    // m == PGSIZE means the whole slot is free.
+    if(gift && m == PGSIZE && (addr + i) % PGSIZE == 0 &&
+       (pte = giftable(pr, addr + i)) != 0){
+      pa = PIPEPAGE(pi, pi->nwrite);
+      memset(pa, 0, PGSIZE);
+      PIPEPAGE(pi, pi->nwrite) = (char*)PTE2PA(*pte);
+      *pte = PA2PTE(pa) | PTE_FLAGS(*pte);
+    } else if(copyin(pr->pagetable, PIPEPAGE(pi, pi->nwrite) + pi->nwrite % PGSIZE,
+                     addr + i, m) == -1){
+      break;
     }
+    pi->nwrite += m;
+    i += m;
   }
-  wakeup(&pi->nread);
+  if(pi->nrsleep)
+    wakeup(&pi->nread);
   release(&pi->lock);
 
   return i;
 }
 
-int
-piperead(struct pipe *pi, uint64 addr, int n)
+// Read up to n bytes to user address addr.  With gift, a full
+// aligned ring page is handed to the user, whose old page takes
+// its place in the ring.
+static int
+pipeget(struct pipe *pi, uint64 addr, int n, int gift)
 {
   int i;
+  uint m;
+  char *pa;
+  pte_t *pte;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -115,16 +188,52 @@ piperead(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
+    pi->nrsleep++;
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    pi->nrsleep--;
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    m = n - i;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > PGSIZE - pi->nread % PGSIZE)
+      m = PGSIZE - pi->nread % PGSIZE;
+    if(gift && m == PGSIZE && (addr + i) % PGSIZE == 0 &&
+       (pte = giftable(pr, addr + i)) != 0){
+      pa = (char*)PTE2PA(*pte);
+      *pte = PA2PTE(PIPEPAGE(pi, pi->nread)) | PTE_FLAGS(*pte);
+      PIPEPAGE(pi, pi->nread) = pa;
+    } else if(copyout(pr->pagetable, addr + i,
+                      PIPEPAGE(pi, pi->nread) + pi->nread % PGSIZE, m) == -1){
       break;
+    }
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(pi->nwsleep)
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+int
+pipewrite(struct pipe *pi, uint64 addr, int n)
+{
+  return pipeput(pi, addr, n, 0);
+}
+
+int
+piperead(struct pipe *pi, uint64 addr, int n)
+{
+  return pipeget(pi, addr, n, 0);
+}
+
+// Like pipewrite() (writing) or piperead(), but moves whole
+// page-aligned pages between the user and the ring without
+// copying.  The user's buffer does not keep its contents.
+int
+pipesplice(struct pipe *pi, uint64 addr, int n, int writing)
+{
+  if(writing)
+    return pipeput(pi, addr, n, 1);
+  return pipeget(pi, addr, n, 1);
+}
@@ -256,6 +256,8 @@ growproc(int n)
   sz = p->sz;
 
   if(n > 0){
+    if(sz + n > vma_base(p))
+      return -1;
     if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
       return -1;
     }
@@ -288,6 +290,18 @@ fork(void)
   }
   np->sz = p->sz;
 
+  // Copy mmap()ed regions.
+  if(vma_fork(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
+  // Unloaded program pages fault in from the same file.
+  if(p->exe)
+    np->exe = idup(p->exe);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -343,6 +357,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Unmap files before closing them; dirty pages are written back.
+  vma_unmapall(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -354,8 +371,11 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->exe)
+    iput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
 
@@ -385,6 +405,9 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // The status is copied out under wait_lock.
+  if(addr != 0)
+    seg_prefault(p, addr, sizeof(int));
   acquire(&wait_lock);
 
   for(;;){
@@ -80,6 +80,25 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A file region mapped into user memory by mmap().
+struct vma {
+  uint64 addr;                 // First byte, page aligned; 0 if unused
+  uint64 len;                  // Length in bytes, a multiple of PGSIZE
+  int prot;                    // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // Mapped file, holds a reference
+  uint off;                    // File offset mapped at addr
+};
+
+// A program segment whose pages exec() left to be read in
+// on first touch.
+struct seg {
+  uint64 va;                   // Page-aligned start
+  uint64 memsz;                // Bytes in memory; 0 if unused
+  uint64 filesz;               // Bytes read from the file
+  uint off;                    // File offset of va
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -104,5 +123,8 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // mmap()ed file regions
+  struct inode *exe;           // Program file, if pages are loaded lazily
+  struct seg seg[NSEG];        // Its segments
   char name[16];               // Process name (debugging)
 };
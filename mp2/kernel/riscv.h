@@ -343,6 +343,7 @@ sfence_vma()
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_A (1L << 6) // accessed
 /* NTU OS 2024 */
 #define PTE_S (1L << 9)   // swapped
 #define PTE_P (1L << 8)   // pinned
@@ -34,3 +34,4 @@
 #define SYS_vmprint  31
 #define SYS_madvise  32
 #define SYS_pgprint  33
+#define SYS_splice   34
@@ -71,11 +71,12 @@ usertrap(void)
     syscall();
   } else if ((which_dev = devintr()) != 0) {
     // ok
-  } else if (scause == 13 || scause == 15) { // Add if statement to catch scause == 13 or 15
-    // Page fault
+  } else if (scause == 12 || scause == 13 || scause == 15) {
+    // Page fault on an instruction fetch, load or store
 
     // Call page fault handling function
-    handle_pgfault();
+    if(handle_pgfault() < 0)
+      p->killed = 1;
     // printf("return from handle_pgfault\n");
     // Return from trap if page fault is handled successfully
     // return;
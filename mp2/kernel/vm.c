@@ -231,10 +231,17 @@ walkaddr(pagetable_t pagetable, uint64 va) {
     return 0;
 
   pte = walk(pagetable, va, 0);
-  if(pte == 0)
-    return 0;
-  if((*pte & PTE_V) == 0)
-    return 0;
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    // A program page not read in yet.  With a spinlock held
+    // (interrupts off), only a bss page can be filled; callers
+    // that copy under a lock seg_prefault() the range first.
+    struct proc *p = myproc();
+    struct seg *s;
+    if(p == 0 || pagetable != p->pagetable || (pte && (*pte & PTE_S)) ||
+       (s = seg_lookup(p, va)) == 0 || seg_fault(p, s, va, intr_get()) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
@@ -292,8 +299,9 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    // Program pages never touched have no PTE.
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;
 
     if(*pte & PTE_S) {
       /* NTU OS 2024 */
@@ -439,8 +447,10 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+    // The child reads program pages never touched by the
+    // parent from the file itself.
+    if((pte = walk(old, i, 0)) == 0 || (*pte & (PTE_V|PTE_S)) == 0)
+      continue;
     if((*pte & PTE_V) == 0)
       panic("uvmcopy: page not present");
     pa = PTE2PA(*pte);
@@ -595,6 +605,15 @@ int madvise(uint64 base, uint64 len, int advice) {
 
     for (uint64 va = begin; va <= last; va += PGSIZE) {
       pte_t *pte = walk(pgtbl, va, 0);
+      struct seg *s = seg_lookup(p, va);
+      if (s && (pte == 0 || !(*pte & (PTE_V | PTE_S)))) {
+        // A program page exec() has not read in yet.
+        if (seg_fault(p, s, va, 1) < 0) {
+          end_op();
+          return -1;
+        }
+        continue;
+      }
       if (pte == 0) {
         end_op();
         return -1; // Failed to find page table entry
@@ -3,6 +3,10 @@
 from gradelib import *
 import os
 
+# The expected page tables record physical addresses in the order
+# exec() allocates them when it loads programs eagerly.
+os.environ["DEMAND_EXEC"] = "0"
+
 
 @test(6, "mp2_1")
 def test_mp2_1():
@@ -480,4 +484,24 @@ def test_mp2_5():
    )
 
 
+@test(5, "mmaptest")
+def test_mmaptest():
+    r = Runner(save("mmaptest.out"))
+    r.run_qemu(shell_script(["mmaptest"]), tg_base='qemu', timeout=300)
+    r.match(
+        '$ mmaptest',
+        'mmaptest: ok'
+    )
+
+
+@test(5, "pipetest")
+def test_pipetest():
+    r = Runner(save("pipetest.out"))
+    r.run_qemu(shell_script(["pipetest"]), tg_base='qemu', timeout=300)
+    r.match(
+        '$ pipetest',
+        'pipetest: ok'
+    )
+
+
 run_tests()
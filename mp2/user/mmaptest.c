@@ -0,0 +1,178 @@
+// Test mmap(): shared and private mappings, write back on munmap,
+// sharing across fork, coherence with write(), and PROT_EXEC.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define FILE "mmap.dat"
+
+void
+err(char *why)
+{
+  printf("mmaptest: %s failed\n", why);
+  unlink(FILE);
+  exit(1);
+}
+
+// Create FILE holding 2.5 pages of 'A' + (i / PGSIZE).
+void
+makefile(void)
+{
+  char buf[512];
+  int fd, i, j;
+
+  unlink(FILE);
+  if((fd = open(FILE, O_WRONLY | O_CREATE)) < 0)
+    err("create");
+  for(i = 0; i < PGSIZE*2 + PGSIZE/2; i += sizeof(buf)){
+    for(j = 0; j < sizeof(buf); j++)
+      buf[j] = 'A' + (i / PGSIZE);
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+      err("write");
+  }
+  close(fd);
+}
+
+void
+check(char *p, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(p[i] != 'A' + (i / PGSIZE))
+      err("content");
+  for(; i % PGSIZE; i++)
+    if(p[i] != 0)
+      err("zero fill");
+}
+
+// li a0, 7; ret
+uint code[] = { 0x00700513, 0x00008067 };
+
+// Code runs from a PROT_EXEC mapping.  Jumping into a mapping
+// without it kills the process.
+void
+execmap(void)
+{
+  int fd, pid, xstate;
+  char *p;
+
+  unlink(FILE);
+  if((fd = open(FILE, O_WRONLY | O_CREATE)) < 0)
+    err("create");
+  if(write(fd, code, sizeof(code)) != sizeof(code))
+    err("write");
+  close(fd);
+
+  if((fd = open(FILE, O_RDONLY)) < 0)
+    err("open");
+  p = mmap(0, PGSIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1)
+    err("mmap exec");
+  if(((int (*)(void))p)() != 7)
+    err("exec mapping");
+  if(munmap(p, PGSIZE) < 0)
+    err("munmap exec");
+
+  p = mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1)
+    err("mmap");
+  close(fd);
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    ((int (*)(void))p)();
+    exit(0);
+  }
+  wait(&xstate);
+  if(xstate != -1)
+    err("exec without PROT_EXEC");
+  if(munmap(p, PGSIZE) < 0)
+    err("munmap");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, n, pid, xstate;
+  char *p, *q, c;
+  struct stat st;
+
+  n = PGSIZE*2 + PGSIZE/2;
+  makefile();
+
+  // Private mapping: reads the file, writes stay private.
+  if((fd = open(FILE, O_RDONLY)) < 0)
+    err("open");
+  p = mmap(0, n, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1)
+    err("mmap private");
+  close(fd);
+  check(p, n);
+  p[0] = 'z';
+  if(munmap(p, n) < 0)
+    err("munmap private");
+  makefile();
+
+  // Shared mapping of a read-only fd must not be writable.
+  if((fd = open(FILE, O_RDONLY)) < 0)
+    err("open");
+  if(mmap(0, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1)
+    err("mmap read-only fd");
+  close(fd);
+
+  // Shared mapping: a child's store reaches the parent and the file.
+  if((fd = open(FILE, O_RDWR)) < 0)
+    err("open");
+  p = mmap(0, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  q = mmap(0, n, PROT_READ, MAP_SHARED, fd, 0);
+  if(p == (char*)-1 || q == (char*)-1)
+    err("mmap shared");
+  check(p, n);
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    p[PGSIZE] = 'x';
+    exit(0);
+  }
+  wait(&xstate);
+  if(xstate != 0 || p[PGSIZE] != 'x' || q[PGSIZE] != 'x')
+    err("shared store");
+
+  // write() updates a mapped page in place.
+  c = 'y';
+  if(write(fd, &c, 1) != 1 || p[0] != 'y')
+    err("write coherence");
+
+  // Unmap the first page, then the rest; dirty pages go to the file.
+  if(munmap(p, PGSIZE) < 0 || munmap(p + PGSIZE, n - PGSIZE) < 0)
+    err("munmap shared");
+  if(munmap(q, n) < 0)
+    err("munmap shared");
+  close(fd);
+
+  if((fd = open(FILE, O_RDONLY)) < 0)
+    err("open");
+  if(read(fd, &c, 1) != 1 || c != 'y')
+    err("read back");
+  p = mmap(0, n, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1 || p[PGSIZE] != 'x')
+    err("write back");
+  close(fd);
+
+  // The file did not grow past its end.
+  if((fd = open(FILE, O_RDONLY)) < 0)
+    err("open");
+  if(fstat(fd, &st) < 0 || st.size != n)
+    err("size");
+  close(fd);
+
+  execmap();
+
+  unlink(FILE);
+  printf("mmaptest: ok\n");
+  exit(0);
+}
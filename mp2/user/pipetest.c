@@ -0,0 +1,253 @@
+// Test pipes: data that wraps around the ring's pages, short
+// reads, and splice() in both directions, which trades whole
+// aligned pages but must copy those of MAP_SHARED mappings.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define RING (4*PGSIZE)
+#define FILE "pipe.dat"
+
+void
+err(char *why)
+{
+  printf("pipetest: %s failed\n", why);
+  unlink(FILE);
+  exit(1);
+}
+
+// Byte number i of the stream.
+char
+pat(int i)
+{
+  return i % 251;
+}
+
+void
+fill(char *p, int off, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    p[i] = pat(off + i);
+}
+
+void
+check(char *p, int off, int n, char *why)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(p[i] != pat(off + i))
+      err(why);
+}
+
+// Read exactly n bytes, in as many reads as it takes.
+void
+readall(int fd, char *p, int n)
+{
+  int r;
+
+  while(n > 0){
+    if((r = read(fd, p, n)) <= 0)
+      err("read");
+    p += r;
+    n -= r;
+  }
+}
+
+// Page-aligned buffer of n pages.
+char*
+pages(int n)
+{
+  char *p = sbrk((n + 1) * PGSIZE);
+
+  if(p == (char*)-1)
+    err("sbrk");
+  return (char*)(((uint64)p + PGSIZE - 1) & ~(PGSIZE - 1));
+}
+
+// Writes and reads that start and end mid-page, so the data
+// crosses the ring's page boundaries and wraps around its end.
+void
+wraparound(char *buf)
+{
+  int fds[2], off, n;
+
+  if(pipe(fds) < 0)
+    err("pipe");
+  fill(buf, 0, 3*PGSIZE + 100);
+  if(write(fds[1], buf, 3*PGSIZE + 100) != 3*PGSIZE + 100)
+    err("write");
+  readall(fds[0], buf, 2*PGSIZE + 50);
+  check(buf, 0, 2*PGSIZE + 50, "wraparound content");
+  off = 3*PGSIZE + 100;
+  n = 2*PGSIZE + 200;    // past the end of the ring and around
+  fill(buf, off, n);
+  if(write(fds[1], buf, n) != n)
+    err("wrapping write");
+  readall(fds[0], buf, off + n - (2*PGSIZE + 50));
+  check(buf, 2*PGSIZE + 50, off + n - (2*PGSIZE + 50), "wrapped content");
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// A child streams many ring-fulls in odd-sized writes.
+void
+stream(char *buf)
+{
+  int fds[2], pid, xstate, off, n, r;
+  int total = 5*RING + 123;
+
+  if(pipe(fds) < 0)
+    err("pipe");
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    close(fds[0]);
+    for(off = 0; off < total; off += n){
+      n = total - off < 3001 ? total - off : 3001;
+      fill(buf, off, n);
+      if(write(fds[1], buf, n) != n)
+        exit(1);
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  off = 0;
+  while((r = read(fds[0], buf, 2999)) > 0){
+    check(buf, off, r, "stream content");
+    off += r;
+  }
+  wait(&xstate);
+  if(xstate != 0 || off != total)
+    err("stream");
+  close(fds[0]);
+}
+
+// A read asking for more than is there returns what there is.
+void
+shortread(char *buf)
+{
+  int fds[2];
+
+  if(pipe(fds) < 0)
+    err("pipe");
+  fill(buf, 0, PGSIZE + 10);
+  if(write(fds[1], buf, PGSIZE + 10) != PGSIZE + 10)
+    err("write");
+  if(read(fds[0], buf, 100) != 100)
+    err("read");
+  check(buf, 0, 100, "short read content");
+  if(read(fds[0], buf, 3*PGSIZE) != PGSIZE - 90)
+    err("short read");
+  check(buf, 100, PGSIZE - 90, "short read content");
+  close(fds[1]);
+  if(read(fds[0], buf, 1) != 0)
+    err("eof");
+  close(fds[0]);
+}
+
+// Aligned pages are traded, the rest copied.
+void
+splicepages(char *buf)
+{
+  int fds[2];
+
+  if(pipe(fds) < 0)
+    err("pipe");
+
+  // Into the pipe: the pages are gone from buf.
+  fill(buf, 0, 2*PGSIZE);
+  if(splice(fds[1], buf, 2*PGSIZE) != 2*PGSIZE)
+    err("splice write");
+  if(buf[0] != 0 || buf[PGSIZE] != 0)
+    err("splice write trade");
+  readall(fds[0], buf, 2*PGSIZE);
+  check(buf, 0, 2*PGSIZE, "splice write content");
+
+  // Out of the pipe, into an aligned buffer.
+  fill(buf, 2*PGSIZE, 2*PGSIZE);
+  if(write(fds[1], buf, 2*PGSIZE) != 2*PGSIZE)
+    err("write");
+  memset(buf, 0, 2*PGSIZE);
+  if(splice(fds[0], buf, 2*PGSIZE) != 2*PGSIZE)
+    err("splice read");
+  check(buf, 2*PGSIZE, 2*PGSIZE, "splice read content");
+
+  // Unaligned, so copied, and a short splice read.
+  fill(buf + 1, 4*PGSIZE, 100);
+  if(splice(fds[1], buf + 1, 100) != 100)
+    err("unaligned splice");
+  check(buf + 1, 4*PGSIZE, 100, "unaligned splice source");
+  if(splice(fds[0], buf, PGSIZE) != 100)
+    err("short splice read");
+  check(buf, 4*PGSIZE, 100, "short splice read content");
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// Pages of a MAP_SHARED mapping belong to the file and are copied.
+void
+spliceshared(char *buf)
+{
+  int fds[2], fd;
+  char *p;
+
+  if((fd = open(FILE, O_RDWR | O_CREATE)) < 0)
+    err("create");
+  memset(buf, 'a', PGSIZE);
+  if(write(fd, buf, PGSIZE) != PGSIZE)
+    err("write file");
+  p = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    err("mmap shared");
+  close(fd);
+  if(pipe(fds) < 0)
+    err("pipe");
+
+  // Splicing from the mapping leaves the file's page in place.
+  fill(p, 0, PGSIZE);
+  if(splice(fds[1], p, PGSIZE) != PGSIZE)
+    err("splice from shared");
+  check(p, 0, PGSIZE, "shared source kept");
+  readall(fds[0], buf, PGSIZE);
+  check(buf, 0, PGSIZE, "splice from shared content");
+
+  // Splicing into it writes the file.
+  fill(buf, PGSIZE, PGSIZE);
+  if(write(fds[1], buf, PGSIZE) != PGSIZE)
+    err("write");
+  if(splice(fds[0], p, PGSIZE) != PGSIZE)
+    err("splice into shared");
+  check(p, PGSIZE, PGSIZE, "splice into shared content");
+  if(munmap(p, PGSIZE) < 0)
+    err("munmap");
+  close(fds[0]);
+  close(fds[1]);
+
+  if((fd = open(FILE, O_RDONLY)) < 0)
+    err("open");
+  readall(fd, buf, PGSIZE);
+  check(buf, PGSIZE, PGSIZE, "file content");
+  close(fd);
+  unlink(FILE);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *buf = pages(4);
+
+  wraparound(buf);
+  stream(buf);
+  shortread(buf);
+  splicepages(buf);
+  spliceshared(buf);
+  printf("pipetest: ok\n");
+  exit(0);
+}
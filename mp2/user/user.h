@@ -24,6 +24,9 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void *mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int splice(int, void*, int);
 #ifdef LAB_NET
 int connect(uint32, uint16, uint16);
 #endif
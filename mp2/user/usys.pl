@@ -36,6 +36,9 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("mmap");
+entry("munmap");
+entry("splice");
 entry("connect");
 entry("pgaccess");
 entry("vmprint");